@@ -0,0 +1,181 @@
+/*------------------------------------------------------------
+File: capture.c
+
+Description: Capture log of the hub (see capture.h).  A record is
+appended by reserving its bytes with an atomic addition and
+copying it into the mapping, under the read side of a lock so that
+the threads of the hub append at the same time; the file is only
+rotated under the write side, once no record is being copied.
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "capture.h"
+
+static char capPath[PATH_MAX];      // path of the capture file
+static long long capSize;           // size of a capture file
+static int capFd = -1;              // the file (-1: not capturing)
+static char *capMap;                // its mapping
+static atomic_llong capUsed;        // bytes reserved after the header (can exceed the space once full)
+static atomic_llong capWritten;     // bytes of the records copied
+static int capGeneration = 0;       // number of files started
+static pthread_rwlock_t capLock = PTHREAD_RWLOCK_INITIALIZER;  // read: appending, write: rotating
+
+static int captureStart();
+static void captureFinish();
+
+/*-------------------------------------------------------------
+Function: captureOpen
+Parameters:
+    path - path of the capture file
+    size - size of a capture file (bytes)
+Description:
+   Starts capturing into path.  Returns 0, or -1 if the file
+   cannot be created (a message is printed).
+-------------------------------------------------------------*/
+int captureOpen(char *path, long long size)
+{
+   snprintf(capPath, PATH_MAX, "%s", path);
+   capSize = size;
+   return(captureStart());
+}
+
+/*-------------------------------------------------------------
+Function: captureStart
+Description:
+   Creates the capture file with its full size, maps it and writes
+   its header.  Returns 0, or -1 on error.
+-------------------------------------------------------------*/
+static int captureStart()
+{
+   struct capHeader hdr;
+   struct timespec ts;
+
+   capFd = open(capPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if(capFd == -1 || ftruncate(capFd, capSize) == -1
+      || (capMap = mmap(NULL, capSize, PROT_READ | PROT_WRITE, MAP_SHARED, capFd, 0)) == MAP_FAILED)
+   {
+      perror(capPath);
+      if(capFd != -1) close(capFd);
+      capFd = -1;
+      return(-1);
+   }
+   madvise(capMap, capSize, MADV_SEQUENTIAL);
+   clock_gettime(CLOCK_REALTIME, &ts);
+   memset(&hdr, 0, sizeof(hdr));
+   strcpy(hdr.magic, CAP_MAGIC);
+   hdr.started = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+   memcpy(capMap, &hdr, sizeof(hdr));
+   atomic_store(&capUsed, 0);
+   atomic_store(&capWritten, 0);
+   capGeneration++;
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: captureFinish
+Description:
+   Unmaps the capture file and cuts it to the records written.
+   Called with the write side of capLock held (or once the hub
+   has stopped).  The records are written contiguously: once one
+   does not fit, none of those reserved after it is written.
+-------------------------------------------------------------*/
+static void captureFinish()
+{
+   munmap(capMap, capSize);
+   if(ftruncate(capFd, sizeof(struct capHeader) + atomic_load(&capWritten)) == -1)
+      perror(capPath);
+   close(capFd);
+   capFd = -1;
+}
+
+/*-------------------------------------------------------------
+Function: captureRun
+Parameters:
+    src       - slot that sent the frames
+    target    - target of the frames (see forwardRun() in hub.c)
+    received  - bitmap of the slots that received them (bit i%32
+                of word i/32, CAP_SLOTS bits)
+    count     - number of frames
+    usec      - time at which they were read
+    frames    - the frames
+    len       - number of bytes in frames
+Description:
+   Appends a record of the frames to the capture file, rotating it
+   when it is full.  Does nothing when not capturing, or if the
+   record can never fit (a message is printed).
+-------------------------------------------------------------*/
+void captureRun(int src, int target, unsigned *received, int count, long long usec, char *frames, int len)
+{
+   struct capRecord *rec;
+   long long need = CAP_RECORD_LEN(len);
+   long long off;
+   int generation;
+   int receivers = 0;
+   int w;
+
+   if(capFd == -1) return;
+   if(need > capSize - (long long) sizeof(struct capHeader))
+   {
+      fprintf(stderr,"hub: capture file too small for %d bytes\n",len);
+      return;
+   }
+   while(1)
+   {
+      pthread_rwlock_rdlock(&capLock);
+      if(capFd == -1)  // the rotation failed
+      {
+         pthread_rwlock_unlock(&capLock);
+         return;
+      }
+      off = atomic_fetch_add(&capUsed, need);
+      if((long long) sizeof(struct capHeader) + off + need <= capSize)
+         break;
+      generation = capGeneration;
+      pthread_rwlock_unlock(&capLock);
+
+      pthread_rwlock_wrlock(&capLock);  // full: the first thread to get here rotates
+      if(generation == capGeneration && capFd != -1)
+      {
+         char oldPath[PATH_MAX+2];
+         captureFinish();
+         snprintf(oldPath, sizeof(oldPath), "%s.1", capPath);
+         rename(capPath, oldPath);
+         captureStart();
+      }
+      pthread_rwlock_unlock(&capLock);
+   }
+   rec = (struct capRecord *) (capMap + sizeof(struct capHeader) + off);
+   memcpy(rec+1, frames, len);
+   rec->len = len;
+   rec->src = src;
+   rec->target = target;
+   for(w=0; w<CAP_SLOTS/32; w++)
+      receivers += __builtin_popcount(received[w]);
+   memcpy(rec->received, received, sizeof(rec->received));
+   rec->receivers = receivers;
+   rec->frames = count;
+   rec->usec = usec;  // last: the record is complete
+   atomic_fetch_add(&capWritten, need);
+   pthread_rwlock_unlock(&capLock);
+}
+
+/*-------------------------------------------------------------
+Function: captureClose
+Description:
+   Stops capturing: the file is cut to the records written.
+-------------------------------------------------------------*/
+void captureClose()
+{
+   pthread_rwlock_wrlock(&capLock);
+   if(capFd != -1)
+      captureFinish();
+   pthread_rwlock_unlock(&capLock);
+}
@@ -0,0 +1,48 @@
+/*------------------------------------------------------------
+File: capture.h
+
+Description: Capture log of the hub (hub -c): every run of frames
+forwarded is appended, with the time it was read, the slot of its
+source, its target and the slots that received it, to a file mapped in memory, so that a frame
+costs a copy and no system call.  The file is created with its full
+size (hub -r); once it is full it is cut to the records written,
+renamed to path.1 (replacing the previous one) and a new file is
+started.  replay.c feeds a capture back into a hub.
+
+File format: a capHeader, then the records one after the other,
+each a capRecord followed by len bytes of frames, padded to a
+multiple of CAP_ALIGN bytes.  A record whose usec is 0 (the unused
+end of a file that was not closed) ends the file.
+-------------------------------------------------------------*/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#define CAP_MAGIC "hubcap2"     // first bytes of a capture file (with the '\0')
+#define CAP_ALIGN 8             // records start at a multiple of CAP_ALIGN bytes
+#define CAP_SIZE (64 << 20)     // default size of a capture file (bytes)
+#define CAP_SLOTS 1024          // slots in the bitmap of the receivers (MAX_STNS of hub.c)
+#define CAP_RECEIVED(rec, i) (((rec)->received[(i)/32] >> ((i)%32)) & 1)  // TRUE if slot i received the frames
+#define CAP_RECORD_LEN(len) ((sizeof(struct capRecord) + (len) + CAP_ALIGN-1) / CAP_ALIGN * CAP_ALIGN)
+
+struct capHeader
+{
+   char magic[8];             // CAP_MAGIC
+   long long started;         // time (usec since the epoch) at which the file was started
+};
+
+struct capRecord
+{
+   long long usec;            // time (usec, CLOCK_MONOTONIC) at which the frames were read
+   int len;                   // bytes of frames following the record
+   short src;                 // slot of the station (or link) that sent them
+   short target;              // slot that received them, -1 for all other slots, or below for a group (see hub.c)
+   short receivers;           // number of slots that received them
+   short frames;              // number of frames
+   unsigned received[CAP_SLOTS/32];  // the slots that received them (see CAP_RECEIVED())
+};
+
+int captureOpen(char *, long long);
+void captureRun(int, int, unsigned *, int, long long, char *, int);
+void captureClose();
+
+#endif
@@ -0,0 +1,182 @@
+/*------------------------------------------------------------
+File: frame.c
+
+Description: Functions on the frame format (see frame.h) shared
+by the hub and the station processes.
+
+scanFrames() finds the frames of a buffer with a vectorized search
+for the delimiters (STX, ETX and BIN_MAGIC): 32 bytes at a time with
+AVX2, 16 with SSE2, or one byte at a time.  frameScanInit() picks
+the best version supported by the processor (CPUID).
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include "frame.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static char *findBytesScalar(char *, char *, char, char);
+// Returns the first byte equal to c1 or c2 in [p, end), or NULL (set by frameScanInit())
+static char *(*findBytes)(char *, char *, char, char) = findBytesScalar;
+
+/*-------------------------------------------------------------
+Function: frameLength
+Parameters:
+    pt  - start of a frame
+    end - end of the data available
+Description:
+   Returns the length of the frame starting at pt: up to and
+   including the ETX for a text frame, the header and the payload
+   for a binary frame.  Returns 0 if the frame is not complete yet
+   and -1 if pt does not start a frame (no STX or BIN_MAGIC, or a
+   binary payload longer than BIN_MAX_LEN).
+-------------------------------------------------------------*/
+int frameLength(char *pt, char *end)
+{
+   char *etx;
+   int len;
+
+   if(*pt == STX)
+   {
+      etx = memchr(pt, ETX, end - pt);
+      return(etx == NULL ? 0 : etx + 1 - pt);
+   }
+   if((unsigned char) *pt != BIN_MAGIC) return(-1);
+   if(end - pt < BIN_HDR_LEN) return(0);
+   len = BIN_GET16(pt + BIN_LEN_POS);
+   if(len > BIN_MAX_LEN) return(-1);
+   return(end - pt < BIN_HDR_LEN + len ? 0 : BIN_HDR_LEN + len);
+}
+
+/*-------------------------------------------------------------
+Function: scanFrames
+Parameters:
+    buf         - buffer to scan
+    len         - number of bytes in buf
+    refs        - to return the frames found
+    max         - maximum number of frames to return
+    consumedPtr - to return the number of bytes covered by the frames
+Description:
+   Finds, in one pass, the frames at the start of buf (see
+   frameLength()) and returns their number.  For each frame, refs
+   gives its offset, length, destination and kind.  Bytes that do not
+   start a frame are returned as FRAME_JUNK up to the next STX or
+   BIN_MAGIC.  The scan stops at an incomplete frame, or after max
+   frames; the bytes before that point are in *consumedPtr.
+-------------------------------------------------------------*/
+int scanFrames(char *buf, int len, struct frameRef *refs, int max, int *consumedPtr)
+{
+   char *pt = buf;         // start of the next frame
+   char *end = buf + len;
+   char *next;             // end of the frame
+   int n = 0;              // number of frames found
+   int plen;               // length of a binary payload
+
+   while(pt < end && n < max)
+   {
+      if(*pt == STX)
+      {
+         if((next = findBytes(pt+1, end, ETX, ETX)) == NULL) break;  // incomplete frame
+         next++;
+         refs[n].kind = FRAME_TEXT;
+         refs[n].dest = next - pt > DEST_POS+1 ? pt[DEST_POS] : 0;
+      }
+      else if((unsigned char) *pt == BIN_MAGIC && (end - pt < BIN_HDR_LEN
+              || (plen = BIN_GET16(pt+BIN_LEN_POS)) <= BIN_MAX_LEN))
+      {
+         if(end - pt < BIN_HDR_LEN || end - pt < BIN_HDR_LEN + plen) break;  // incomplete frame
+         next = pt + BIN_HDR_LEN + plen;
+         refs[n].kind = FRAME_BIN;
+         refs[n].dest = pt[DEST_POS];
+      }
+      else
+      {
+         if((next = findBytes(pt+1, end, STX, (char) BIN_MAGIC)) == NULL) next = end;
+         refs[n].kind = FRAME_JUNK;
+         refs[n].dest = 0;
+      }
+      refs[n].offset = pt - buf;
+      refs[n].len = next - pt;
+      n++;
+      pt = next;
+   }
+   *consumedPtr = pt - buf;
+   return(n);
+}
+
+/*-------------------------------------------------------------
+Function: findBytesScalar
+Description:
+   Version of findBytes() examining one byte at a time.
+-------------------------------------------------------------*/
+static char *findBytesScalar(char *p, char *end, char c1, char c2)
+{
+   for( ; p < end ; p++)
+      if(*p == c1 || *p == c2) return(p);
+   return(NULL);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*-------------------------------------------------------------
+Function: findBytesSSE2
+Description:
+   Version of findBytes() comparing 16 bytes at a time.
+-------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static char *findBytesSSE2(char *p, char *end, char c1, char c2)
+{
+   __m128i v1 = _mm_set1_epi8(c1);
+   __m128i v2 = _mm_set1_epi8(c2);
+   __m128i b;
+   int mask;
+
+   for( ; end - p >= 16 ; p += 16)
+   {
+      b = _mm_loadu_si128((__m128i *) p);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)));
+      if(mask != 0) return(p + __builtin_ctz(mask));
+   }
+   return(findBytesScalar(p, end, c1, c2));
+}
+
+/*-------------------------------------------------------------
+Function: findBytesAVX2
+Description:
+   Version of findBytes() comparing 32 bytes at a time.
+-------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static char *findBytesAVX2(char *p, char *end, char c1, char c2)
+{
+   __m256i v1 = _mm256_set1_epi8(c1);
+   __m256i v2 = _mm256_set1_epi8(c2);
+   __m256i b;
+   unsigned mask;
+
+   for( ; end - p >= 32 ; p += 32)
+   {
+      b = _mm256_loadu_si256((__m256i *) p);
+      mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(b, v1), _mm256_cmpeq_epi8(b, v2)));
+      if(mask != 0) return(p + __builtin_ctz(mask));
+   }
+   return(findBytesSSE2(p, end, c1, c2));
+}
+#endif
+
+/*-------------------------------------------------------------
+Function: frameScanInit
+Description:
+   Selects the version of findBytes() used by scanFrames() according
+   to the instructions supported by the processor.  Must be called
+   before any thread is created.
+-------------------------------------------------------------*/
+void frameScanInit()
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      findBytes = findBytesAVX2;
+   else if(__builtin_cpu_supports("sse2"))
+      findBytes = findBytesSSE2;
+#endif
+}
@@ -0,0 +1,104 @@
+/*------------------------------------------------------------
+File: frame.h
+
+Description: Definitions of the frame format shared by the hub
+and the station processes.
+
+Frame format: STX D S - <message> ETX
+    D - identifier of the destination station
+    S - identifier of the source station
+Frames sent with a window (stn -w) carry a sequence number:
+              STX D S # <seq> <message> ETX
+    seq - SEQ_LEN hexadecimal digits; for an acknowledgement it is
+          the sequence number of the next message expected
+          (cumulative acknowledgement)
+Until its first message is acknowledged, a station marks its messages
+with the session it starts (a number drawn at random), so that the
+receivers start counting again when a station is attached again under
+the same identifier:
+              STX D S ! <session> <seq> <message> ETX
+    session - SEQ_LEN hexadecimal digits, never 0
+
+Destinations: D is a station identifier, BROADCAST_ID (all other
+stations) or a group identifier (GROUP_FIRST to GROUP_LAST); the hub
+sends the frames for a group only to its members.  A station joins
+group G with the frame (handled by the hub, never forwarded):
+              STX G S JOIN_SEP ETX
+
+Binary frames (version BIN_VERSION) have a fixed header followed by
+len bytes of payload, so they are delimited without scanning and
+can carry any bytes:
+    BIN_MAGIC D S version type flags len(2) seq(4)
+    D and S are at DEST_POS and SRC_POS as in the text frames;
+    len and seq are big endian.  An acknowledgement has type BIN_ACK
+    and no payload.  With BIN_F_SYN, the high 16 bits of seq hold
+    the session.
+A station asks to use binary frames by sending a BIN_HELLO frame
+with the highest version it supports; the hub answers with a
+BIN_HELLO frame holding the version to use (0: text frames only).
+Two linked hubs (hub -H, -L and -U) exchange BIN_LINK frames with
+their identifiers and the roots of their trees (loop prevention).
+-------------------------------------------------------------*/
+#ifndef FRAME_H
+#define FRAME_H
+
+#define ACKNOWLEDGEMENT "Ack"  // acknowledgement message
+#define STX '@'       // Start of the frame - start of Xmission
+#define ETX '~'       // End of the frame - end of Xmission
+#define STX_POS 0     // Position of STX
+#define DEST_POS 1    // Position of the destination identifier
+#define SRC_POS 2     // Position of the source identifier
+#define MSG_POS 4     // Position of the message
+#define SEP_POS 3     // Position of the separator ('-' or SEQ_SEP)
+#define SEQ_SEP '#'   // Separator of a frame with a sequence number
+#define SEQ_POS 4     // Position of the sequence number
+#define SEQ_LEN 4     // Number of hexadecimal digits of the sequence number
+#define SEQ_MSG_POS (SEQ_POS+SEQ_LEN)  // Position of the message after a sequence number
+#define SEQ_MOD 65536 // Sequence numbers wrap around modulo SEQ_MOD
+#define SYN_SEP '!'   // Separator of a frame with a session and a sequence number
+#define SYN_MSG_POS (SEQ_MSG_POS+SEQ_LEN)  // Position of the message after them
+#define JOIN_SEP '+'  // Separator of a join frame
+#define BROADCAST_ID '*'  // Destination of a frame for all other stations
+#define GROUP_FIRST '0'   // Identifiers of the groups
+#define GROUP_LAST '9'
+#define IS_GROUP(id) ((id) >= GROUP_FIRST && (id) <= GROUP_LAST)
+
+// Binary frames
+#define BIN_MAGIC 0xA5     // First byte of a binary frame
+#define BIN_VERSION 1      // Version of the binary format
+#define BIN_VERSION_POS 3  // Position of the version
+#define BIN_TYPE_POS 4     // Position of the type
+#define BIN_FLAGS_POS 5    // Position of the flags
+#define BIN_LEN_POS 6      // Position of the payload length (2 bytes)
+#define BIN_SEQ_POS 8      // Position of the sequence number (4 bytes)
+#define BIN_HDR_LEN 12     // Length of the header
+#define BIN_MAX_LEN (BUFSIZ - BIN_HDR_LEN)  // Maximum payload length
+#define BIN_MSG 1          // Type of a message
+#define BIN_ACK 2          // Type of an acknowledgement
+#define BIN_HELLO 3        // Type of a negotiation frame (station <-> hub)
+#define BIN_LINK 4         // Type of a link frame (hub <-> hub)
+#define BIN_LINK_LEN 8     // Payload of a link frame: hub id(4) root id(4)
+#define BIN_F_SEQ 0x01     // Flag: the sequence number is valid
+#define BIN_F_SYN 0x02     // Flag: the high 16 bits of the sequence number are a session
+#define BIN_GET16(p) (((unsigned char)(p)[0] << 8) | (unsigned char)(p)[1])
+#define BIN_GET32(p) (((unsigned)BIN_GET16(p) << 16) | BIN_GET16((p)+2))
+#define BIN_PUT16(p,v) ((p)[0] = ((v) >> 8) & 0xff, (p)[1] = (v) & 0xff)
+#define BIN_PUT32(p,v) (BIN_PUT16((p), (unsigned)(v) >> 16), BIN_PUT16((p)+2, (v)))
+
+// Frames found by scanFrames()
+#define FRAME_TEXT 1   // text frame (STX ... ETX)
+#define FRAME_BIN 2    // binary frame
+#define FRAME_JUNK 3   // bytes that do not start a frame, up to the next frame
+struct frameRef
+{
+   int offset;           // position of the frame in the buffer scanned
+   int len;              // length of the frame
+   unsigned char dest;   // destination identifier (0 for FRAME_JUNK)
+   unsigned char kind;   // FRAME_TEXT, FRAME_BIN or FRAME_JUNK
+};
+
+int frameLength(char *, char *);
+void frameScanInit();
+int scanFrames(char *, int, struct frameRef *, int, int *);
+
+#endif
@@ -0,0 +1,166 @@
+/*------------------------------------------------------------
+File: framepool.c
+
+Description: Pool of reference-counted frame buffers of the hub
+(see framepool.h).  Each size has a free list protected by its
+own lock; the reference counts are atomic so that a buffer can be
+released by any thread.
+-------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "framepool.h"
+
+#define POOL_SIZES 2
+
+struct poolSize
+{
+   int size;                 // bytes in the data of the buffers
+   int stride;               // bytes between two buffers of an arena
+   struct frameBuf *free;    // free buffers
+   int total;                // buffers made
+   int inUse;                // buffers held by output queues
+   pthread_mutex_t lock;
+};
+
+static struct poolSize sizes[POOL_SIZES] = {
+   {POOL_SMALL, 0, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER},
+   {BUFSIZ, 0, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER},
+};
+
+/*-------------------------------------------------------------
+Function: poolGrow
+Parameters:
+    ps - size of buffers
+    n  - number of buffers to add
+Description:
+   Allocates a cache-line aligned arena of n buffers and puts them
+   on the free list.  Called with the lock of the size held.
+   Returns FALSE if the memory cannot be allocated.
+-------------------------------------------------------------*/
+static int poolGrow(struct poolSize *ps, int n)
+{
+   char *arena;
+   struct frameBuf *fb;
+   int i;
+
+   ps->stride = (sizeof(struct frameBuf) + ps->size + POOL_LINE-1) / POOL_LINE * POOL_LINE;
+   arena = aligned_alloc(POOL_LINE, (size_t) n * ps->stride);
+   if(arena == NULL)
+      return(0);
+   for(i=0; i<n; i++)
+   {
+      fb = (struct frameBuf *) (arena + (size_t) i * ps->stride);
+      fb->size = ps->size;
+      fb->next = ps->free;
+      ps->free = fb;
+   }
+   ps->total += n;
+   return(1);
+}
+
+/*-------------------------------------------------------------
+Function: poolInit
+Description:
+   Makes POOL_PREALLOC buffers of each size.
+-------------------------------------------------------------*/
+void poolInit()
+{
+   int i;
+
+   for(i=0; i<POOL_SIZES; i++)
+   {
+      pthread_mutex_lock(&sizes[i].lock);
+      if(!poolGrow(&sizes[i], POOL_PREALLOC))
+         perror("hub: frame pool");
+      pthread_mutex_unlock(&sizes[i].lock);
+   }
+}
+
+/*-------------------------------------------------------------
+Function: poolGet
+Parameters:
+    data - frames to copy
+    len  - number of bytes (at most BUFSIZ)
+Description:
+   Takes a free buffer of the smallest size that holds len bytes
+   (growing the pool if none is free), copies the frames into it
+   and gives it a reference count of 1.
+   Returns NULL if len is too large or the pool cannot grow.
+-------------------------------------------------------------*/
+struct frameBuf *poolGet(char *data, int len)
+{
+   struct poolSize *ps;
+   struct frameBuf *fb;
+   int i;
+
+   for(i=0; i<POOL_SIZES && sizes[i].size < len; i++)
+      ;
+   if(i == POOL_SIZES)
+      return(NULL);
+   ps = &sizes[i];
+   pthread_mutex_lock(&ps->lock);
+   if(ps->free == NULL && !poolGrow(ps, POOL_CHUNK))
+   {
+      pthread_mutex_unlock(&ps->lock);
+      return(NULL);
+   }
+   fb = ps->free;
+   ps->free = fb->next;
+   ps->inUse++;
+   pthread_mutex_unlock(&ps->lock);
+   atomic_store_explicit(&fb->refs, 1, memory_order_relaxed);
+   memcpy(fb->data, data, len);
+   return(fb);
+}
+
+/*-------------------------------------------------------------
+Function: poolRef
+Parameters:
+    fb - buffer
+Description:
+   Adds a reference to the buffer (one more queue holds it).
+-------------------------------------------------------------*/
+void poolRef(struct frameBuf *fb)
+{
+   atomic_fetch_add_explicit(&fb->refs, 1, memory_order_relaxed);
+}
+
+/*-------------------------------------------------------------
+Function: poolRelease
+Parameters:
+    fb - buffer
+Description:
+   Removes a reference to the buffer and returns it to the free
+   list of its size when it was the last one.
+-------------------------------------------------------------*/
+void poolRelease(struct frameBuf *fb)
+{
+   struct poolSize *ps;
+
+   if(atomic_fetch_sub_explicit(&fb->refs, 1, memory_order_acq_rel) != 1)
+      return;
+   ps = &sizes[fb->size == POOL_SMALL ? 0 : 1];
+   pthread_mutex_lock(&ps->lock);
+   fb->next = ps->free;
+   ps->free = fb;
+   ps->inUse--;
+   pthread_mutex_unlock(&ps->lock);
+}
+
+/*-------------------------------------------------------------
+Function: poolDump
+Parameters:
+    fd - file descriptor to print to
+Description:
+   Prints, for each size, the buffers made and those in use.
+-------------------------------------------------------------*/
+void poolDump(int fd)
+{
+   int i;
+
+   dprintf(fd, "hub stats: pool");
+   for(i=0; i<POOL_SIZES; i++)
+      dprintf(fd, " %d bytes: %d buffers, %d in use;", sizes[i].size, sizes[i].total, sizes[i].inUse);
+   dprintf(fd, "\n");
+}
@@ -0,0 +1,43 @@
+/*------------------------------------------------------------
+File: framepool.h
+
+Description: Pool of frame buffers of the hub.  A run of frames
+that must wait in output queues (batching or backpressure, see
+hub.c) is copied once into a buffer of the pool, which is shared
+by all the queues holding it: its reference count is the number
+of queues, and it returns to the pool when the last of them has
+written (or dropped) it.
+
+The buffers are carved out of cache-line aligned arenas, in two
+sizes (POOL_SMALL for the usual runs of a few frames, and BUFSIZ
+for a full reassembly buffer).  POOL_PREALLOC buffers of each size
+are made by poolInit(); an arena of POOL_CHUNK more is added when
+a size runs out, so forwarding allocates nothing once the pool has
+grown to the largest number of runs waiting.
+-------------------------------------------------------------*/
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define POOL_LINE 64        // buffers start on their own cache line
+#define POOL_SMALL 256      // bytes of the small buffers
+#define POOL_PREALLOC 1024  // buffers of each size made by poolInit()
+#define POOL_CHUNK 256      // buffers added when a size runs out
+
+struct frameBuf
+{
+   atomic_int refs;          // output queues holding the buffer
+   int size;                 // bytes in data (POOL_SMALL or BUFSIZ)
+   struct frameBuf *next;    // next free buffer of the same size
+   char data[];              // the frames
+} __attribute__((aligned(POOL_LINE)));
+
+void poolInit();
+struct frameBuf *poolGet(char *, int);
+void poolRef(struct frameBuf *);
+void poolRelease(struct frameBuf *);
+void poolDump(int);
+
+#endif
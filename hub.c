@@ -6,27 +6,312 @@ Student Name: Shaughn Finnerty
 Student Number: 6300433
 
 Description:  This program creates the station processes
-     (A, B, C, and D) and then acts as a Ethernet/802.3 hub.
+     (A, B, C, and D, or those given on the command line) and then
+     acts as a Ethernet/802.3 hub.  Stations can also be attached
+     and detached while the hub runs, through a control socket (-C).
+     The hub forwards traffic either with one thread per station
+     (-m threads, the default) or with a single epoll event loop
+     over all transmission pipes (-m epoll), or floods the pipes'
+     contents without copying them through the hub (-m splice), or
+     with a pool of workers that steal the ready pipes from each
+     other (-m pool and -w), or with a single loop reading and
+     writing through io_uring (-m uring, epoll when the kernel has
+     no io_uring).  Frames are either
+     flooded to all other stations (-f flood, the default) or
+     switched to the station that owns the destination identifier
+     once the hub has learned it (-f switch); frames for a group
+     go to its members only (-G, or stations joining it).  Text and
+     binary frames are both forwarded (-F binary lets the stations
+     use binary frames, see frame.h).  Stations are connected
+     to the hub with pipes (-x pipe, the default) or with rings in
+     shared memory (-x shm, see shmring.h).  In the epoll and uring
+     modes, frames can be queued per reception pipe and written in
+     batches with writev() (-b and -d).  The output queues can also be
+     bounded (-q) so that a slow station does not stall the hub: the
+     reception pipes are then non-blocking and the frames a station
+     has no space for wait in its queue, with an overflow policy (-o)
+     when it is full.  Counters of the traffic of each
+     station are kept (see stats.h) and printed periodically (-i)
+     or to each client of a Unix-domain socket (-S).  Hubs can be
+     cascaded to share the stations between several processes: a hub
+     is linked to another as if it were one of its stations, over a
+     pipe pair (-H creates a hub below this one) or a Unix-domain
+     socket (-U connects to the -L socket of the hub above).  The
+     frames forwarded can be logged to a capture file (-c and -r,
+     see capture.h), and the stations and forwarding threads pinned
+     to processors (-A and -P, see placement.h).  The run ends after
+     -t seconds, -n frames or -I idle seconds, or on SIGINT or
+     SIGTERM; the stations are then drained and reaped.
 -------------------------------------------------------------*/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include "frame.h"
+#include "shmring.h"
+#include "stats.h"
+#include "framepool.h"
+#include "capture.h"
+#include "placement.h"
+#include "uring.h"
 
 #define OK 1
+#define TRUE 1
+#define FALSE 0
 #define PROGRAM_STN "stn"  // The program that acts like a station
-#define MAX_STNS 10        // Maximum number of stations
+#define MAX_STNS 1024      // Maximum number of stations attached at the same time
+#if MAX_STNS > CAP_SLOTS
+#error "the capture records (capture.h) have a bit for each of CAP_SLOTS slots only"
+#endif
+#define RUN_TIME 30        // Number of seconds the hub forwards traffic
+#define END_CHECK 100      // msecs between two checks of the end of the run (see hubFinished())
+#define FLUSH_MSECS 1000   // msecs the output queues have to be written once the hub drains
+#define DRAIN_SECS 5       // seconds the stations have to terminate once the hub drains
+#define CONTROL_TIMEOUT 5  // Seconds a client of the control socket can stay idle
+#define MAX_HUB_ARGS 64    // Arguments of a hub created with -H
+#define LINK_TRIES 50      // Attempts to connect to the uplink hub (-U)
+#define LINK_TRY_USEC 100000  // Time between two attempts
+// Kinds of slots (see linkKind)
+#define LINK_NONE 0        // a station
+#define LINK_UP 1          // the hub above this one (at most one)
+#define LINK_DOWN 2        // a hub below this one
+// Hub modes (selected with -m on the command line)
+#define MODE_THREADS 1     // one thread per station blocked in read()
+#define MODE_EPOLL 2       // one thread, epoll over all transmission pipes
+#define MODE_SPLICE 3      // as MODE_EPOLL, flooding with tee()/splice() (no frame inspection)
+#define MODE_POOL 4        // a pool of workers sharing the stations (see runWorkerPool())
+#define POOL_EVENTS 64     // pipes reported by one epoll_wait() of a worker
+#define POOL_WAKE UINT32_MAX  // epoll data of the eventfd waking a worker up
+#define POOL_JOIN_SECS 1   // seconds the workers have to stop once the hub stops
+#define MODE_URING 5       // as MODE_EPOLL, reading and writing through io_uring (see runUringLoop())
+#define URING_ENTRIES 4096 // entries of the ring (at most a read and a writev per slot are pending)
+#define URING_LAST_MSECS 1000  // msecs the last writes have to complete once the hub stops
+#define URING_READ 0       // kinds of the requests of the ring
+#define URING_WRITE 1
+#define URING_WAKE 2
+#define URING_DATA(kind, stn) ((unsigned long long) uringGen[stn] << 32 | (kind) << 16 | (stn))
+#define FLOOD -1           // target of a frame sent to all other stations
+#define N_GROUPS (GROUP_LAST-GROUP_FIRST+1)  // number of group identifiers (see frame.h)
+#define GROUP_TARGET(g) (-2-(g))  // target of a frame for group g (below FLOOD), and back
+#define FRAME_BATCH 64     // number of frames found per call to scanFrames()
+// Transports between the hub and the stations (selected with -x on the command line)
+#define TRANSPORT_PIPE 1   // a transmission and a reception pipe per station
+#define TRANSPORT_SHM 2    // a shared memory link per station (see shmring.h)
+// Overflow policies of the output queues (selected with -o on the command line)
+#define POLICY_DROP_NEWEST 1  // the frames that do not fit are dropped
+#define POLICY_DROP_OLDEST 2  // the oldest frames waiting are dropped
+#define POLICY_DISCONNECT 3   // the station is detached
 // Note that the terms reception and transmission are relatif to the station and not the hub
 // Note that the descriptors at the same index in the two arrays are related to the same station,
 // for example, fdsRec[2] and fdsTran[2] contain the fds of the pipes connected to the same station.
-int fdsRec[MAX_STNS+1];    // file descriptors for writing ends (reception)
-int fdsTran[MAX_STNS+1];   // file descriptors for reading ends (transmission)
+// Each index is the slot of a station: the slots from nStns on have never been used, fdsTran
+// is -1 in a free slot, and fdsRec is -1 once the station is detached (it receives nothing
+// more).  A slot is freed by releaseStation() when its station is gone, and then reused.
+int fdsRec[MAX_STNS];      // file descriptors for writing ends (reception)
+int fdsTran[MAX_STNS];     // file descriptors for reading ends (transmission)
+atomic_int nStns = 0;      // number of slots used so far
+pthread_mutex_t stnsLock = PTHREAD_MUTEX_INITIALIZER;  // serializes creating and freeing slots
+int pids[MAX_STNS];        // process of each station
+char *configs[MAX_STNS];   // configuration file of each station
+// Threads mode: the thread listening to each station (joined before its slot is reused).
+// Epoll and splice modes: the epoll instance of the loop (-1 while it does not run).
+pthread_t listeners[MAX_STNS];
+int hasListener[MAX_STNS]; // TRUE while listeners[i] must be joined
+int loopFd = -1;
+int listening = FALSE;     // TRUE while the hub forwards (new stations are listened to at once)
+int hubMode = MODE_THREADS;  // hub mode (-m)
+// Bytes read from a transmission pipe are kept in the reassembly buffer of the station
+// until they form complete frames (STX ... ETX); only complete frames are forwarded.
+struct reasmBuf
+{
+   char data[BUFSIZ];      // bytes read but not yet forwarded
+   int len;                // number of bytes in data
+   long long readAt;       // time (usec) of the last read (for the latency histogram)
+};
+struct reasmBuf reasmBufs[MAX_STNS];  // reassembly buffers (same index as fdsTran)
+pthread_mutex_t recLocks[MAX_STNS];   // serializes the writes into each reception pipe (and its closing)
+// Switching (-f switch): the hub learns the station index from which each source identifier
+// transmits and sends frames for a known destination only to that station.
+int switching = 0;                    // TRUE when frames are switched rather than flooded
+atomic_int learnedStn[256];           // index+1 of the station using an identifier (0: unknown)
+// Batching (-b and -d, epoll mode only): runs of frames for a reception pipe are copied into
+// its output queue and written with a single writev() once batchSize runs are waiting or
+// the first one has waited flushDelay microseconds.  A run flooded to several queues is
+// copied once into a buffer of the frame pool that they share.
+struct outQueue
+{
+   struct iovec iov[IOV_MAX];  // runs of frames waiting to be written
+   struct frameBuf *bufs[IOV_MAX];  // the copies of the runs (released once written, see framepool.h)
+   long long readAt[IOV_MAX];  // time (usec) at which each run was read
+   int frames[IOV_MAX];        // number of frames in each run (counted once written, see stats.h)
+   int count;                  // number of runs waiting
+   long long since;            // time (usec) at which the first waiting run was queued
+   int blocked;                // TRUE while waiting for space in the pipe (see watchRec())
+   int inFlight;               // runs of the writev() pending in the ring (-m uring, see postQueue())
+};
+struct outQueue outQueues[MAX_STNS];  // output queues (same index as fdsRec)
+int batchSize = 1;                    // number of runs written per writev (1: no batching)
+long long flushDelay = 0;             // maximum time (usec) a run waits in a queue
+// Backpressure (-q and -o): the reception pipes are non-blocking, the runs a station has no space
+// for wait in its output queue (at most queueLimit runs, all modes but splice) and are written
+// once drainFd (the epoll instance of the loop, or of the drainRec() thread) reports space.
+int queueLimit = 0;                   // maximum runs in an output queue (0: writes block instead)
+int overflowPolicy = POLICY_DROP_NEWEST;  // what happens to a full queue
+int drainFd = -1;                     // epoll instance watching the pipes of the blocked queues
+// Shared memory transport (-x shm): fdsTran holds the eventfd signaled when the station
+// transmits and fdsRec the eventfd signaled when it frees space in its reception ring.
+int transport = TRANSPORT_PIPE;       // transport used for all stations
+struct shmLink *links[MAX_STNS];      // link of each station (NULL with pipes)
+int wakeFds[MAX_STNS];                // eventfd on which each station is woken up
+int binaryVersion = BIN_VERSION;      // binary frames accepted (-F text: 0, text frames only)
+int runTime = RUN_TIME;               // seconds the hub forwards traffic (-t)
+// End of the run (see hubFinished()): the stations are drained once runTime seconds have passed,
+// frameLimit frames were forwarded (-n), nothing arrived for idleTime seconds (-I) or on a signal.
+long long frameLimit = 0;             // frames forwarded before the hub stops (0: no limit)
+int idleTime = 0;                     // seconds without data before the hub stops (0: never)
+atomic_ullong framesForwarded = 0;    // frames read from the stations (counted with -n only)
+volatile sig_atomic_t stopSignal = 0; // signal that stopped the hub (0: none)
+long long drainStart = 0;             // when the hub started draining the stations (0: not yet)
+int endPids[MAX_STNS];                // process of each station drained
+int exitPids[MAX_STNS];               // process of the station reaped by serveHub() (0: none)
+int exitStatus[MAX_STNS];             // and its status (see reapStation())
+char *endNames[MAX_STNS];             // and its configuration file (NULL: not drained)
+int startDelay = 1;                   // seconds between the creation of two stations (-s)
+char stnDir[PATH_MAX] = "./";         // where stn and its default configurations are (see findStnDir())
+char stnPath[PATH_MAX+8];             // stnDir PROGRAM_STN
+char *stnProgram = NULL;              // path of the station program (-p, stnPath by default)
+// Statistics (see stats.h): printed every statsInterval seconds on the standard error (-i)
+// and to each client connecting to the Unix-domain socket statsPath (-S).
+struct stnStats hubStats[MAX_STNS];   // counters of each station (same index as fdsTran)
+int statsInterval = 0;                // seconds between two prints (0: none)
+char *statsPath = NULL;               // path of the statistics socket (NULL: none)
+char *controlPath = NULL;             // path of the control socket (-C, NULL: none)
+// Cascade (-H, -U, -L and -u): a slot can hold a link to another hub rather than a station.
+// The hubs form a tree; each one knows the identifier of its root (see handleLink()).
+int linkKind[MAX_STNS];               // LINK_NONE, LINK_UP or LINK_DOWN (same index as fdsTran)
+unsigned hubId;                       // identifier of this hub (its pid)
+unsigned rootId;                      // identifier of the root of the tree of this hub
+char *linkPath = NULL;                // socket on which hubs below connect (-L, NULL: none)
+// Groups (-G and join frames, see frame.h): a frame for a group identifier is sent only to the
+// slots of its bitmap, which holds the stations that joined it and the links to other hubs.
+atomic_uint groupMembers[N_GROUPS][MAX_STNS/32];  // slots of each group (one bit per slot)
+char *groupConfig[N_GROUPS];          // identifiers of the stations put in each group by -G (NULL: none)
+int stnIds[MAX_STNS];                 // identifier the station transmits from (-1: not seen yet)
+// Capture (-c and -r, see capture.h): every run of frames forwarded is logged for replay.c.
+char *capturePath = NULL;             // path of the capture file (NULL: none)
+long long captureSize = CAP_SIZE;     // size of a capture file before it is rotated
+// Placement (-A and -P, see placement.h): processors of the forwarding threads and the stations.
+int placePolicy = PLACE_NONE;         // placement policy
+int fifoPriority = 0;                 // SCHED_FIFO priority of the forwarding threads (0: none)
+// Pool mode (-m pool and -w): a fixed number of workers, each owning a shard of the slots, that
+// steal the ready pipes queued by the others when they have nothing to do (see runWorker()).
+struct worker
+{
+   pthread_t thread;
+   int epollFd;               // epoll instance of the transmission pipes of its slots
+   int wakeFd;                // eventfd waking the worker up (POOL_WAKE)
+   atomic_int idle;           // TRUE while the worker has nothing to do
+   pthread_mutex_t lock;      // protects the jobs
+   int jobs[MAX_STNS];        // slots whose pipe is ready, not yet read (circular, from head)
+   int head;
+   int count;                 // number of jobs
+} __attribute__((aligned(64)));
+struct worker *workers;               // the workers (nWorkers)
+int nWorkers = 0;                     // number of workers (0 until set: one per processor online)
+atomic_int poolStop = FALSE;          // TRUE once the workers must stop
+// io_uring mode (-m uring, see uring.h): the ring is only used by the thread of runUringLoop().
+struct uring ring = { .fd = -1 };     // the ring (fd -1: not open)
+pthread_t uringThread;                // the thread using it
+int uringWakeFd = -1;                 // eventfd waking the loop up for the stations attached by other threads
+unsigned long long uringWake;         // value read from uringWakeFd
+atomic_int uringNew = FALSE;          // TRUE when slots wait for their first read (or queues for a write)
+char uringArm[MAX_STNS];              // TRUE for the slots whose first read must be posted
+unsigned uringGen[MAX_STNS];          // generation of each slot (increased when the loop releases it)
+int uringWrites = 0;                  // writev() pending in the ring
 
 /* Prototypes */
-void createStation(char *);
+void findStnDir();
+int createStation(char *);
+void createStations(char *);
+int selectConfig(const struct dirent *);
+void startListening(int);
+int detachStation(int);
+void closeRec(int);
+void releaseStation(int);
+int findSlot();
+void fillSlot(int, int, int, int, char *, int);
+int attachLink(int, int, int, char *, int);
+int createSubHub(char *);
+int connectUplink(char *);
+void sendLink(int);
+void announceRoot(unsigned);
+void handleLink(int, char *);
+void learnId(int, unsigned char);
+void joinGroup(int, int);
+void leaveGroups(int);
 void createHubThreads();
 void *listenTran(void *);
+void runEventLoop();
+void runSpliceLoop();
+void runWorkerPool();
+void *runWorker(void *);
+int takeJob(struct worker *);
+int stealJob(struct worker *);
+void serveJob(int);
+void runUringLoop();
+void armSlots();
+void postRead(int);
+void postQueue(int);
+void uringDone(unsigned long long, int);
+void queueDone(int, unsigned, int);
+void spliceTran(int, int [2], int, char *);
+int readTran(int);
+void forwardRead(int, int);
+void forwardFrames(int);
+int frameTarget(int, char *, int);
+void forwardRun(int, int, char *, int, int);
+void answerHello(int, char *);
+void deliver(int, char *, int, int, long long, struct frameBuf **);
+int writeAll(int, char *, int, int *);
+int writeRec(int, char *, int);
+void closeStations();
+void enqueueRun(int, char *, int, int, long long, struct frameBuf **);
+void flushQueue(int);
+long long flushQueues(int);
+void watchRec(int, int);
+void drainQueue(int);
+void *drainRec(void *);
+long long nowUsec();
+int waitEvents(int, struct epoll_event *, int, long long);
+void startService();
+int openSocket(char *);
+void *serveHub(void *);
+void handleControl(int);
+void dumpStats(int);
+void stopHub(int);
+int hubFinished();
+void endStations();
+int reapStation(int, int *);
 
 /*-------------------------------------------------------------
 Function: main
@@ -34,31 +319,292 @@ Parameters:
     int ac - number of arguments on the command line
     char **av - array of pointers to the arguments
 Description:
-    Creates the stations using createStation() and threads using
-    using createHubThreads().  createHubThreads() cancels
-    (terminates) the threads after 30 seconds.
+    Creates the stations using createStation() and then forwards
+    traffic according to the hub mode given with -m:
+       threads - createHubThreads() creates one thread per station
+                 and waits for the end of the run.
+       epoll   - runEventLoop() serves all stations from this thread
+                 until the end of the run.
+       splice  - runSpliceLoop() does the same, flooding the data
+                 without copying it into the hub.
+       pool    - runWorkerPool() serves all stations with -w workers
+                 (one per processor by default) that share the work.
+       uring   - runUringLoop() serves all stations from this thread
+                 through io_uring, or falls back to runEventLoop()
+                 when the kernel (or the build) has no io_uring.
+    -f selects how frames are forwarded: flood (to all other stations)
+    or switch (see frameTarget()).
+    -b n sets the number of writes coalesced into one writev() per
+    reception pipe and -d usecs the maximum time a frame is delayed
+    for this (epoll and uring modes only, see enqueueRun()).
+    -q runs bounds the output queue of each station and makes the
+    reception pipes non-blocking; -o selects what happens when a
+    queue is full: drop-newest (the default), drop-oldest or
+    disconnect (see enqueueRun()).  The uring mode never waits for
+    a station, so its queues hold at most IOV_MAX runs without -q.
+    -x selects the transport to the stations: pipe or shm.
+    -F text makes the hub refuse binary frames to the stations that
+    ask for them (see answerHello()).
+    -t secs sets the time the hub forwards traffic (RUN_TIME by default);
+    the run also ends after -n frames, after -I secs without traffic,
+    or on SIGINT or SIGTERM, and the stations are then drained and
+    reaped (see hubFinished() and endStations()).
+    -s secs the delay between the creation of two stations and -p the
+    path of the station program.  The configuration files of the
+    stations can be given after the options, and -D dir adds those
+    of a directory (see createStations()); stnA.cfg to stnD.cfg
+    (in the directory of the hub, see findStnDir()) are used when the
+    hub has nothing else to serve.
+    -i secs prints the statistics every secs seconds and -S path
+    serves them on a Unix-domain socket (see serveHub()); either
+    one also prints them when the hub stops.
+    -C path accepts commands to attach and detach stations on a
+    Unix-domain socket (see handleControl()).
+    -H "options" creates a hub below this one with the options (it
+    can be repeated), -L path accepts hubs below this one on a
+    Unix-domain socket and -U path connects to the hub above this
+    one; -u makes the standard input and output the link to the hub
+    above (used by -H).  See attachLink().
+    -G g=ids defines group g (a digit) and puts in it the stations
+    with the identifiers ids as soon as they transmit (it can be
+    repeated); stations also join groups themselves (see joinGroup()).
+    -c path appends the frames forwarded to the capture file path,
+    rotated every -r mbytes (see capture.h; not with -m splice).
+    -A none|spread|dedicated|colocate pins the stations and the
+    forwarding threads to processors (in the pool mode, the workers
+    get a processor each, and colocate shares it with the stations
+    each one serves), and -P prio runs the forwarding threads under
+    SCHED_FIFO (see placement.h).
 -------------------------------------------------------------*/
 int main(int ac, char **av)
 {
    int i;
+   int opt;
+   char *dir = NULL;         // directory of configuration files (-D)
+   char *subHubs[MAX_STNS];  // options of the hubs to create below this one (-H)
+   int nSubHubs = 0;
+   char *uplinkPath = NULL;  // socket of the hub above (-U)
+   int stdioUplink = FALSE;  // TRUE when the hub above is on the standard input and output (-u)
+   struct rlimit lim;
+   struct sigaction sa;
+
+   while((opt = getopt(ac, av, "m:f:b:d:x:F:t:s:p:i:S:D:C:q:o:H:L:U:uG:c:r:A:P:w:n:I:")) != -1)
+   {
+      if(opt == 'm' && strcmp(optarg, "threads") == 0) hubMode = MODE_THREADS;
+      else if(opt == 'm' && strcmp(optarg, "epoll") == 0) hubMode = MODE_EPOLL;
+      else if(opt == 'm' && strcmp(optarg, "splice") == 0) hubMode = MODE_SPLICE;
+      else if(opt == 'm' && strcmp(optarg, "pool") == 0) hubMode = MODE_POOL;
+      else if(opt == 'm' && strcmp(optarg, "uring") == 0) hubMode = MODE_URING;
+      else if(opt == 'w' && atoi(optarg) > 0 && atoi(optarg) <= MAX_STNS) nWorkers = atoi(optarg);
+      else if(opt == 'f' && strcmp(optarg, "flood") == 0) switching = 0;
+      else if(opt == 'f' && strcmp(optarg, "switch") == 0) switching = 1;
+      else if(opt == 'b' && atoi(optarg) >= 1 && atoi(optarg) <= IOV_MAX) batchSize = atoi(optarg);
+      else if(opt == 'd' && atoll(optarg) >= 0) flushDelay = atoll(optarg);
+      else if(opt == 'x' && strcmp(optarg, "pipe") == 0) transport = TRANSPORT_PIPE;
+      else if(opt == 'x' && strcmp(optarg, "shm") == 0) transport = TRANSPORT_SHM;
+      else if(opt == 'F' && strcmp(optarg, "text") == 0) binaryVersion = 0;
+      else if(opt == 'F' && strcmp(optarg, "binary") == 0) binaryVersion = BIN_VERSION;
+      else if(opt == 't' && atoi(optarg) > 0) runTime = atoi(optarg);
+      else if(opt == 'n' && atoll(optarg) > 0) frameLimit = atoll(optarg);
+      else if(opt == 'I' && atoi(optarg) > 0) idleTime = atoi(optarg);
+      else if(opt == 's' && atoi(optarg) >= 0) startDelay = atoi(optarg);
+      else if(opt == 'p') stnProgram = optarg;
+      else if(opt == 'i' && atoi(optarg) > 0) statsInterval = atoi(optarg);
+      else if(opt == 'S') statsPath = optarg;
+      else if(opt == 'D') dir = optarg;
+      else if(opt == 'C') controlPath = optarg;
+      else if(opt == 'q' && atoi(optarg) >= 0 && atoi(optarg) <= IOV_MAX) queueLimit = atoi(optarg);
+      else if(opt == 'o' && strcmp(optarg, "drop-newest") == 0) overflowPolicy = POLICY_DROP_NEWEST;
+      else if(opt == 'o' && strcmp(optarg, "drop-oldest") == 0) overflowPolicy = POLICY_DROP_OLDEST;
+      else if(opt == 'o' && strcmp(optarg, "disconnect") == 0) overflowPolicy = POLICY_DISCONNECT;
+      else if(opt == 'H' && nSubHubs < MAX_STNS) subHubs[nSubHubs++] = optarg;
+      else if(opt == 'L') linkPath = optarg;
+      else if(opt == 'U' && !stdioUplink) uplinkPath = optarg;
+      else if(opt == 'u' && uplinkPath == NULL) stdioUplink = TRUE;
+      else if(opt == 'G' && IS_GROUP(optarg[0]) && optarg[1] == '=') groupConfig[optarg[0]-GROUP_FIRST] = optarg+2;
+      else if(opt == 'c') capturePath = optarg;
+      else if(opt == 'r' && atoll(optarg) > 0) captureSize = atoll(optarg) << 20;
+      else if(opt == 'A' && strcmp(optarg, "none") == 0) placePolicy = PLACE_NONE;
+      else if(opt == 'A' && strcmp(optarg, "spread") == 0) placePolicy = PLACE_SPREAD;
+      else if(opt == 'A' && strcmp(optarg, "dedicated") == 0) placePolicy = PLACE_DEDICATED;
+      else if(opt == 'A' && strcmp(optarg, "colocate") == 0) placePolicy = PLACE_COLOCATE;
+      else if(opt == 'P' && atoi(optarg) > 0) fifoPriority = atoi(optarg);
+      else
+      {
+         fprintf(stderr,"Usage: hub [-m threads|epoll|splice|pool|uring] [-w workers] [-f flood|switch] [-b writes] [-d usecs] [-x pipe|shm] [-F text|binary]\n"
+                        "           [-q runs] [-o drop-newest|drop-oldest|disconnect] [-t secs] [-n frames] [-I secs] [-s secs] [-p stn] [-G g=ids]\n"
+                        "           [-i secs] [-S path] [-D dir] [-C path] [-H options] [-L path] [-U path | -u]\n"
+                        "           [-c path] [-r mbytes] [-A none|spread|dedicated|colocate] [-P prio] [config ...]\n");
+         exit(-1);
+      }
+   }
+   if(batchSize > 1 && hubMode != MODE_EPOLL && hubMode != MODE_URING)
+   {
+      fprintf(stderr,"hub: batching (-b) requires -m epoll or -m uring\n");
+      exit(-1);
+   }
+   if(transport == TRANSPORT_SHM && hubMode == MODE_URING)
+   {
+      fprintf(stderr,"hub: -m uring requires -x pipe (the rings need no system call)\n");
+      exit(-1);
+   }
+   if(switching && hubMode == MODE_SPLICE)
+   {
+      fprintf(stderr,"hub: -m splice does not inspect frames and can only flood\n");
+      exit(-1);
+   }
+   for(i=0; i<N_GROUPS; i++)
+      if(groupConfig[i] != NULL && hubMode == MODE_SPLICE)
+      {
+         fprintf(stderr,"hub: -m splice does not inspect frames and sends the frames for a group to all stations (-G)\n");
+         exit(-1);
+      }
+   if(transport == TRANSPORT_SHM && hubMode == MODE_SPLICE)
+   {
+      fprintf(stderr,"hub: -m splice requires -x pipe\n");
+      exit(-1);
+   }
+   if(queueLimit > 0 && hubMode == MODE_SPLICE)
+   {
+      fprintf(stderr,"hub: -m splice does not inspect frames and cannot queue them (-q)\n");
+      exit(-1);
+   }
+   if(hubMode == MODE_SPLICE && (nSubHubs > 0 || linkPath != NULL || uplinkPath != NULL || stdioUplink))
+   {
+      fprintf(stderr,"hub: -m splice cannot link hubs (their streams are not cut on frame boundaries)\n");
+      exit(-1);
+   }
+   if(capturePath != NULL && hubMode == MODE_SPLICE)
+   {
+      fprintf(stderr,"hub: -m splice does not inspect frames and cannot capture them (-c)\n");
+      exit(-1);
+   }
+   if(queueLimit > 0 && queueLimit < batchSize)
+   {
+      fprintf(stderr,"hub: the output queues (-q) must hold at least a batch (-b)\n");
+      exit(-1);
+   }
+
+   if(nWorkers == 0)
+      nWorkers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+   if(hubMode == MODE_URING && uringOpen(&ring, URING_ENTRIES) == -1)
+   {
+      fprintf(stderr,"hub: io_uring unavailable (%s), using -m epoll\n",strerror(errno));
+      hubMode = MODE_EPOLL;
+   }
+   if(hubMode == MODE_URING && queueLimit == 0)
+      queueLimit = IOV_MAX;  // a station that does not read must not grow its queue past its arrays
+   uringThread = pthread_self();  // the loop runs in this thread
 
    // Initialization
-   fdsRec[0] = -1; // empty list
-   fdsTran[0] = -1; // empty list
+   findStnDir();
+   if(stnProgram == NULL)
+      stnProgram = stnPath;
+   frameScanInit();
+   poolInit();
+   signal(SIGPIPE, SIG_IGN);  // a station that terminates is detached (see writeRec())
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = stopHub;
+   sa.sa_flags = SA_RESTART;  // the reads of the threads go on
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   // two descriptors per station: allow as many as the system lets us
+   if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+   {
+      lim.rlim_cur = lim.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &lim);
+   }
    
+   hubId = rootId = getpid();
+   if(capturePath != NULL && captureOpen(capturePath, captureSize) == -1)
+      exit(-1);
+   if((placePolicy != PLACE_NONE || fifoPriority != 0) && placeInit(placePolicy, fifoPriority, hubMode == MODE_POOL ? nWorkers : 0) == -1)
+      exit(-1);
+   if(statsInterval > 0 || statsPath != NULL || controlPath != NULL || linkPath != NULL)
+      startService();  // before the uplink, so that the hubs of a cascade can be started together
+   // Linking the other hubs
+   if(stdioUplink)
+      attachLink(0, 1, getppid(), "uplink (standard input and output)", LINK_UP);
+   else if(uplinkPath != NULL)
+      connectUplink(uplinkPath);
+   for(i=0; i<nSubHubs; i++)
+      createSubHub(subHubs[i]);
+
    // Creating the stations
-   createStation("/home/genh/h/f8/sfinn038/School/CSI3131/a1/stnA.cfg");
-   createStation("/home/genh/h/f8/sfinn038/School/CSI3131/a1/stnB.cfg");
-   createStation("/home/genh/h/f8/sfinn038/School/CSI3131/a1/stnC.cfg");
-   createStation("/home/genh/h/f8/sfinn038/School/CSI3131/a1/stnD.cfg");
-   // creating threads for the hub
-   createHubThreads();  
-   // On return from the function - all threads are terminated.
-   // When the hub process terminates, all write ends of the reception pipes
-   // are closed, which should have the stations terminate.
+   for(i=optind; i<ac; i++)
+   {
+      createStation(av[i]);
+      /*
+         Added this sleep so we can see the first message sent from each station in order. 
+         Not necessary, but slows it down a bit (-s 0 removes it).
+      */
+      sleep(startDelay);
+   }
+   if(dir != NULL)
+      createStations(dir);
+   if(optind == ac && dir == NULL && nStns == 0 && linkPath == NULL)
+   {
+      char config[PATH_MAX+16];
+      for(i=0; i<4; i++)
+      {
+         snprintf(config, sizeof(config), "%sstn%c.cfg", stnDir, 'A'+i);
+         createStation(config);
+         sleep(startDelay);
+      }
+   }
+   if(hubMode == MODE_EPOLL)
+      runEventLoop();
+   else if(hubMode == MODE_SPLICE)
+      runSpliceLoop();
+   else if(hubMode == MODE_POOL)
+      runWorkerPool();
+   else if(hubMode == MODE_URING)
+      runUringLoop();
+   else
+      // creating threads for the hub
+      createHubThreads();  
+   // On return from the function - all threads are terminated and
+   // the stations drained (see hubFinished()); the stations left are
+   // killed by endStations().
+   closeStations();  // reception rings of the shm transport not closed yet
+   endStations();
+   captureClose();
+   if(statsInterval > 0 || statsPath != NULL)
+      dumpStats(2);  // final statistics
+   if(statsPath != NULL) unlink(statsPath);
+   if(controlPath != NULL) unlink(controlPath);
+   if(linkPath != NULL) unlink(linkPath);
    return(0);  // All is done.
 }
 
+/*-------------------------------------------------------------
+Function: findStnDir
+Description:
+    Sets stnDir to the directory of the hub program (read from
+    /proc/self/exe), where stn and the default configurations are
+    looked for; it stays "./" if the link cannot be read.  stnPath
+    is the station program in it.
+-------------------------------------------------------------*/
+void findStnDir()
+{
+   char exe[PATH_MAX];
+   char *slash;
+   ssize_t len;
+
+   len = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+   if(len > 0)
+   {
+      exe[len] = '\0';
+      slash = strrchr(exe, '/');
+      if(slash != NULL)
+      {
+         slash[1] = '\0';
+         snprintf(stnDir, sizeof(stnDir), "%s", exe);
+      }
+   }
+   snprintf(stnPath, sizeof(stnPath), "%s%s", stnDir, PROGRAM_STN);
+}
+
 /*-------------------------------------------------------------
 Function: createStation
 Parameters:
@@ -71,152 +617,688 @@ Description:
                         output of the station process (stn).
 			The read end remains attached to the hub
 			process and its file descriptor is stored
-			in fdsTran (at its end).
+			in fdsTran (in the first free slot).
     Reception  pipe:  The read end is attached to the standard
                       input of the station process (stn).
 		      The write end remains attached to the hub
 		      process and its file descriptor is stored
-		      in fdsRec (at its end).
+		      in fdsRec (in the same slot).
     Note that the fds of the pipes in the fdsTran and fdsRec arrays
     are stored at the same index.
-    All fds not used in both the station and hub processes are closed.
+    All fds of the hub are created close-on-exec, so the station
+    process only keeps its standard input and output.
+    With the shm transport, a shared memory link and three eventfds
+    replace the pipes: the station is given the memfd of the link and
+    the eventfds with the -s option (see stn.c), fdsTran and fdsRec
+    hold the eventfds the station signals, and wakeFds the one on
+    which it waits.  The station is killed if the hub dies since it
+    cannot see the hub close its end of the link.
+    Can be called while the hub forwards traffic (see handleControl()):
+    the station is listened to at once (see startListening()), and
+    the other stations only send it frames once its slot is complete.
+    Returns the slot of the station, or -1 if it cannot be created.
 -------------------------------------------------------------*/
-void createStation(char *fileConfig)
+int createStation(char *fileConfig)
 {
 
 	int pid;
 	int tranPipeFds[2];
 	int recPipeFds[2];
-	int pipeStatus;
-	int endIndex;
-	
-	pipeStatus = pipe(tranPipeFds);
-	if (pipeStatus == -1){
-		fprintf(stderr, "Transmission pipe creation failed.");
-		exit(-1);
+	int stn;              // slot of the station
+	int memfd;            // memfd of the shared memory link
+	int wakeFd = -1;      // eventfd on which the station waits (shm)
+	struct shmLink *lk = NULL;  // shared memory link (shm)
+	char shmArg[64];      // -s argument of the station (memfd:wake:data:space)
+
+	if (access(fileConfig, R_OK) == -1){
+		perror(fileConfig);
+		return(-1);
 	}
-	pipeStatus = pipe(recPipeFds);
-	if (pipeStatus == -1){
-		fprintf(stderr, "Reception pipe creation failed.");
-		exit(-1);
+	pthread_mutex_lock(&stnsLock);
+	if ((stn = findSlot()) == -1){
+		pthread_mutex_unlock(&stnsLock);
+		return(-1);
 	}
-	
-	/*
-		Determine the first occurence of an empty fd reference in the reception pipe array. 
-		We assume that this is the same index of the first available empty position in the transmission array
-		based on the design of the system.
-	*/
-	for(endIndex=0 ; fdsRec[endIndex] != -1 ; endIndex++)
-		if (endIndex+1 == MAX_STNS){
-			fprintf(stderr, "The hub has reached its maximum of %d stations. Cannot create another.", MAX_STNS);
-			return;
+
+	if (transport == TRANSPORT_SHM){
+		lk = shmLinkCreate(&memfd);
+		tranPipeFds[0] = eventfd(0, EFD_CLOEXEC);
+		recPipeFds[1] = eventfd(0, EFD_CLOEXEC | (queueLimit > 0 ? EFD_NONBLOCK : 0));
+		wakeFd = eventfd(0, EFD_CLOEXEC);
+		if (lk == NULL || tranPipeFds[0] == -1 || recPipeFds[1] == -1 || wakeFd == -1){
+			perror("Shared memory link creation failed");
+			if (lk != NULL){ munmap(lk, sizeof(struct shmLink)); close(memfd); }
+			if (tranPipeFds[0] != -1) close(tranPipeFds[0]);
+			if (recPipeFds[1] != -1) close(recPipeFds[1]);
+			if (wakeFd != -1) close(wakeFd);
+			pthread_mutex_unlock(&stnsLock);
+			return(-1);
+		}
+		sprintf(shmArg, "%d:%d:%d:%d", memfd, wakeFd, tranPipeFds[0], recPipeFds[1]);
+	} else {
+		if (pipe2(tranPipeFds, O_CLOEXEC) == -1){
+			perror("Transmission pipe creation failed");
+			pthread_mutex_unlock(&stnsLock);
+			return(-1);
+		}
+		if (pipe2(recPipeFds, O_CLOEXEC) == -1){
+			perror("Reception pipe creation failed");
+			close(tranPipeFds[0]);
+			close(tranPipeFds[1]);
+			pthread_mutex_unlock(&stnsLock);
+			return(-1);
 		}
+	}
 
     pid = fork(); /* fork another process */
     if (pid < 0){
-        fprintf(stderr, "Fork Failed");
-        exit(-1); /* fork failed */
+        perror("Fork Failed");
+		if (transport == TRANSPORT_SHM){
+			munmap(lk, sizeof(struct shmLink));
+			close(memfd);
+			close(wakeFd);
+		} else {
+			close(tranPipeFds[1]);
+			close(recPipeFds[0]);
+		}
+		close(tranPipeFds[0]);
+		close(recPipeFds[1]);
+        pthread_mutex_unlock(&stnsLock);  // the slot was not filled: findSlot() finds it again
+        return(-1); /* fork failed */
+    } else if (pid == 0 && transport == TRANSPORT_SHM) { /* child process with the shm transport */
+		/*
+			Only the memfd and the eventfds of this station must survive the exec.
+		*/
+		fcntl(wakeFd, F_SETFD, 0);
+		fcntl(tranPipeFds[0], F_SETFD, 0);
+		fcntl(recPipeFds[1], F_SETFD, 0);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		placeStation(stn);
+		signal(SIGINT, SIG_IGN);  // the hub drains the station (see stopHub())
+		execlp(stnProgram, PROGRAM_STN, "-s", shmArg, fileConfig, NULL);
+		perror("execlp");
+		exit(-1);
     } else if (pid == 0) { /* child process */
 
-		
-		/* 
-			Attach the write end fd of the transmission pipe [1] to stdout of the station process, 
+
+		/*
+			Attach the write end fd of the transmission pipe [1] to stdout of the station process,
 			and close the original stdout fd.
 		 */
 		dup2(tranPipeFds[1],1);
-		/*
-			Close the original file descriptors to the transmission pipe.
-		*/
-		close(tranPipeFds[0]);
-		close(tranPipeFds[1]);
 
-		/* 
-			Attach the read end fd of the reception pipe [0] to stdin fd of the station process, 
+		/*
+			Attach the read end fd of the reception pipe [0] to stdin fd of the station process,
 			and close the original stdin fd.
 		*/
 		dup2(recPipeFds[0], 0);
+		placeStation(stn);  // processor of the station (see placement.h)
+		signal(SIGINT, SIG_IGN);  // the hub drains the station (see stopHub())
 		/*
-			Close the original file descriptors to the reception pipes.
-		*/
-		close(recPipeFds[1]);
-		close(recPipeFds[0]);		
-		/*
-			Close all the file descriptors duplicated from the parent process (i.e. hub) that point to the pipes
-			of all other stations.
+			The original file descriptors of the pipes, and those of all other stations,
+			are close-on-exec.
 		*/
-		int c;
-		for (c=0; c<=endIndex; c++){
-			close(fdsRec[c]);
-			close(fdsTran[c]);
-		}
-		
-		int i = execlp("/home/genh/h/f8/sfinn038/School/CSI3131/a1/stn", PROGRAM_STN, fileConfig, NULL);
+		int i = execlp(stnProgram, PROGRAM_STN, fileConfig, NULL);
 		// i will only be assigned a value if this call fails (i.e. -1)
 		printf("%d\n", i);
+		exit(-1);
+    } else if (transport == TRANSPORT_SHM) { /* parent process with the shm transport */
+		close(memfd);  // the link stays mapped
     } else { /* parent process */
-		//store read end fd of tran pipe [0] in fdsTran(at its end)
-		fdsTran[endIndex] = tranPipeFds[0];
 		//close the write end fd to the transmission pipe created for the station process
 		close(tranPipeFds[1]);
-
-		//store write end fd of rec pipe [1] in fdsRec(at its end)
-		fdsRec[endIndex] = recPipeFds[1];		
 		//close the read end fd to the reception pipe created for the station process
 		close(recPipeFds[0]);
-	
-		endIndex = endIndex + 1;
-		fdsRec[endIndex] = -1;
-		fdsTran[endIndex] = -1;	
-		
-		/*
-			Added this sleep so we can see the first message sent from each station in order. 
-			Not necessary, but slows it down a bit.
-		*/
-		sleep(1);	
+		if (queueLimit > 0 && hubMode != MODE_URING)  // see flushQueue()
+			fcntl(recPipeFds[1], F_SETFL, O_NONBLOCK);
     }
 
+	links[stn] = lk;
+	wakeFds[stn] = wakeFd;
+	//store read end fd of tran pipe [0] in fdsTran and write end fd of rec pipe [1] in fdsRec
+	fillSlot(stn, tranPipeFds[0], recPipeFds[1], pid, fileConfig, LINK_NONE);
+	pthread_mutex_unlock(&stnsLock);
+	return(stn);
+}
+
+/*-------------------------------------------------------------
+Function: findSlot
+Description:
+    Returns the first free slot (fdsTran is -1), or the first slot
+    never used, or -1 if all MAX_STNS slots are used or the hub
+    is draining its stations (see hubFinished()).
+    Called with stnsLock held.
+-------------------------------------------------------------*/
+int findSlot()
+{
+	int stn;
+
+	if (drainStart != 0){
+		fprintf(stderr, "The hub is stopping. Cannot create another station.\n");
+		return(-1);
+	}
+	for(stn=0 ; stn < nStns && fdsTran[stn] != -1 ; stn++)
+		;
+	if (stn == MAX_STNS){
+		fprintf(stderr, "The hub has reached its maximum of %d stations. Cannot create another.\n", MAX_STNS);
+		return(-1);
+	}
+	return(stn);
+}
+
+/*-------------------------------------------------------------
+Function: fillSlot
+Parameters:
+    stn    - slot found by findSlot()
+    fdTran - fd on which the hub reads what the station transmits
+    fdRec  - fd on which the hub writes what the station receives
+    pid    - process of the station (0 if none)
+    name   - configuration file, or description of a link
+    kind   - LINK_NONE for a station, or the kind of link to a hub
+Description:
+    Fills the slot (links and wakeFds are set by the caller), puts
+    a link to another hub in all groups, and starts listening to it if the hub forwards traffic; the other
+    stations send frames to it once fdsRec is set.
+    Called with stnsLock held.
+-------------------------------------------------------------*/
+void fillSlot(int stn, int fdTran, int fdRec, int pid, char *name, int kind)
+{
+	int i;
+
+	if (stn == nStns)
+		pthread_mutex_init(&recLocks[stn], NULL);
+	reasmBufs[stn].len = 0;
+	memset(&hubStats[stn], 0, sizeof(struct stnStats));
+	linkKind[stn] = kind;
+	stnIds[stn] = -1;
+	if (kind != LINK_NONE)  // the members of the groups can be behind the other hub
+		for (i=0; i<N_GROUPS; i++)
+			joinGroup(stn, i);
+	pids[stn] = pid;
+	exitPids[stn] = 0;
+	configs[stn] = strdup(name);
+	fdsTran[stn] = fdTran;
+	pthread_mutex_lock(&recLocks[stn]);
+	fdsRec[stn] = fdRec;
+	pthread_mutex_unlock(&recLocks[stn]);
+	if (stn == nStns)
+		atomic_store(&nStns, stn + 1);
+	if (listening)
+		startListening(stn);
+}
+
+/*-------------------------------------------------------------
+Function: createStations
+Parameters:
+    dir - directory of configuration files
+Description:
+    Creates a station for each file of the directory whose name
+    ends with ".cfg" (see selectConfig()), in alphabetical order.
+-------------------------------------------------------------*/
+void createStations(char *dir)
+{
+	struct dirent **names;
+	char path[PATH_MAX];
+	int n;
+	int i;
+
+	n = scandir(dir, &names, selectConfig, alphasort);
+	if (n == -1){
+		perror(dir);
+		return;
+	}
+	for (i=0; i<n; i++){
+		snprintf(path, PATH_MAX, "%s/%s", dir, names[i]->d_name);
+		createStation(path);
+		sleep(startDelay);
+		free(names[i]);
+	}
+	free(names);
+}
+
+/*-------------------------------------------------------------
+Function: selectConfig
+Parameters:
+    entry - entry of a directory
+Description:
+    Returns TRUE if the name of the entry ends with ".cfg".
+-------------------------------------------------------------*/
+int selectConfig(const struct dirent *entry)
+{
+	int len = strlen(entry->d_name);
+
+	return(len > 4 && strcmp(entry->d_name + len - 4, ".cfg") == 0);
+}
+
+/*-------------------------------------------------------------
+Function: startListening
+Parameters:
+    stn - slot of the station
+Description:
+    Starts reading the transmission pipe of the station: creates
+    its thread (listenTran(), placed by placeWorker()) in the threads mode, or adds the pipe,
+    made non-blocking, to the epoll instance of the loop.
+    Called with stnsLock held, once the hub forwards traffic.
+-------------------------------------------------------------*/
+void startListening(int stn)
+{
+	struct epoll_event ev;
+
+	if (hubMode == MODE_THREADS){
+		if (hasListener[stn]){  // thread of the previous station of the slot
+			pthread_join(listeners[stn], NULL);
+			hasListener[stn] = FALSE;
+		}
+		if (pthread_create(&listeners[stn], NULL, listenTran, &fdsTran[stn]) != 0)
+			perror("hub: pthread_create");
+		else {
+			hasListener[stn] = TRUE;
+			placeWorker(listeners[stn], stn);
+		}
+		return;
+	}
+	if (hubMode == MODE_URING){  // the ring waits for the data (a link shares its socket with fdsRec)
+		fcntl(fdsTran[stn], F_SETFL, fcntl(fdsTran[stn], F_GETFL) & ~O_NONBLOCK);
+		uringArm[stn] = TRUE;
+		atomic_store(&uringNew, TRUE);
+		eventSignal(uringWakeFd);
+		return;
+	}
+	fcntl(fdsTran[stn], F_SETFL, fcntl(fdsTran[stn], F_GETFL) | O_NONBLOCK);
+	ev.events = hubMode == MODE_POOL ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+	ev.data.u32 = stn;
+	if (epoll_ctl(hubMode == MODE_POOL ? workers[stn % nWorkers].epollFd : loopFd, EPOLL_CTL_ADD, fdsTran[stn], &ev) == -1)
+		perror("hub: epoll_ctl");
+}
+
+/*-------------------------------------------------------------
+Function: detachStation
+Parameters:
+    stn - slot of the station
+Description:
+    Detaches the station: closes its reception pipe (or ring) so
+    that it terminates, and stops sending it frames.  Its slot is
+    freed by releaseStation() once it has closed its transmission
+    pipe.  Returns FALSE if no station is attached in the slot.
+-------------------------------------------------------------*/
+int detachStation(int stn)
+{
+	int done = FALSE;
+
+	if (stn < 0 || stn >= nStns) return(FALSE);
+	pthread_mutex_lock(&recLocks[stn]);
+	if (fdsRec[stn] != -1){
+		closeRec(stn);
+		done = TRUE;
+	}
+	pthread_mutex_unlock(&recLocks[stn]);
+	return(done);
+}
+
+/*-------------------------------------------------------------
+Function: closeRec
+Parameters:
+    stn - slot of the station
+Description:
+    Closes the reception pipe (or ring) of the station and discards
+    its output queue (see detachStation()), counting its frames as
+    dropped; the runs being written by the ring are freed once
+    written (see queueDone()).  Called with the lock of the station
+    held.
+-------------------------------------------------------------*/
+void closeRec(int stn)
+{
+	struct outQueue *q = &outQueues[stn];
+	int i;
+
+	if (q->blocked)
+		watchRec(stn, FALSE);
+	for (i=q->inFlight; i<q->count; i++){
+		STAT_ADD(&hubStats[stn], framesDropped, q->frames[i]);
+		poolRelease(q->bufs[i]);
+	}
+	q->count = q->inFlight;
+	statsQueue(&hubStats[stn], q->count);
+	if (links[stn] != NULL)
+		ringClose(&links[stn]->down, wakeFds[stn]);
+	close(fdsRec[stn]);
+	fdsRec[stn] = -1;
+}
+
+/*-------------------------------------------------------------
+Function: releaseStation
+Parameters:
+    stn - slot of the station
+Description:
+    Called by the reader of the station (its thread or the loop)
+    when the station has closed its transmission pipe: detaches it
+    if needed, forgets the identifiers learned on it, removes it
+    from the groups, closes its descriptors and frees the slot.
+-------------------------------------------------------------*/
+void releaseStation(int stn)
+{
+	int expected;
+	int i;
+
+	detachStation(stn);
+	if (linkKind[stn] == LINK_UP)  // this hub is the root of its tree again
+		announceRoot(hubId);
+	linkKind[stn] = LINK_NONE;
+	for (i=0; i<256; i++){
+		expected = stn+1;
+		atomic_compare_exchange_strong(&learnedStn[i], &expected, 0);
+	}
+	leaveGroups(stn);
+	pthread_mutex_lock(&stnsLock);
+	if (loopFd != -1)
+		epoll_ctl(loopFd, EPOLL_CTL_DEL, fdsTran[stn], NULL);
+	else if (hubMode == MODE_POOL)
+		epoll_ctl(workers[stn % nWorkers].epollFd, EPOLL_CTL_DEL, fdsTran[stn], NULL);
+	close(fdsTran[stn]);
+	if (links[stn] != NULL){
+		munmap(links[stn], sizeof(struct shmLink));
+		close(wakeFds[stn]);
+		links[stn] = NULL;
+	}
+	free(configs[stn]);
+	configs[stn] = NULL;
+	fdsTran[stn] = -1;  // the slot is free
+	pthread_mutex_unlock(&stnsLock);
+}
+
+/*-------------------------------------------------------------
+Function: attachLink
+Parameters:
+    fdTran - fd on which the other hub is read
+    fdRec  - fd on which the other hub is written
+    pid    - process of the other hub (0 if not a child of this hub)
+    name   - description of the link (see handleControl())
+    kind   - LINK_UP (the other hub is the uplink) or LINK_DOWN
+Description:
+    Attaches another hub in a slot as if it were a station: the
+    frames of the stations behind it are forwarded to this hub's
+    stations and theirs to it, and with -f switch the identifiers
+    of the stations behind it are learned on its slot.  The hubs
+    of a cascade must form a tree, so each one first announces the
+    root of its tree with a BIN_LINK frame (see handleLink()).
+    Returns the slot of the link, or -1 (the fds are then closed).
+-------------------------------------------------------------*/
+int attachLink(int fdTran, int fdRec, int pid, char *name, int kind)
+{
+	int stn;
+
+	pthread_mutex_lock(&stnsLock);
+	if ((stn = findSlot()) == -1 || fdRec == -1){
+		pthread_mutex_unlock(&stnsLock);
+		close(fdTran);
+		if (fdRec != -1) close(fdRec);
+		return(-1);
+	}
+	if (queueLimit > 0 && hubMode != MODE_URING)  // see flushQueue()
+		fcntl(fdRec, F_SETFL, fcntl(fdRec, F_GETFL) | O_NONBLOCK);
+	links[stn] = NULL;
+	wakeFds[stn] = -1;
+	fillSlot(stn, fdTran, fdRec, pid, name, kind);
+	sendLink(stn);
+	pthread_mutex_unlock(&stnsLock);
+	return(stn);
+}
+
+/*-------------------------------------------------------------
+Function: createSubHub
+Parameters:
+    options - options of the hub to create, separated by spaces
+Description:
+    Creates another hub process with the options (the same program
+    as this hub, with -u) and attaches it as a downlink over a pipe
+    pair, in the same way as createStation() attaches a station.
+    The other hub terminates with this one.
+    Returns the slot of the link, or -1.
+-------------------------------------------------------------*/
+int createSubHub(char *options)
+{
+	int tranPipeFds[2];
+	int recPipeFds[2];
+	char *args[MAX_HUB_ARGS];
+	char *copy = strdup(options);
+	char name[BUFSIZ];
+	char *opt;
+	int n = 0;
+	int pid;
+
+	args[n++] = "hub";
+	args[n++] = "-u";
+	for (opt = strtok(copy, " "); opt != NULL && n < MAX_HUB_ARGS-1; opt = strtok(NULL, " "))
+		args[n++] = opt;
+	args[n] = NULL;
+	if (pipe2(tranPipeFds, O_CLOEXEC) == -1 || pipe2(recPipeFds, O_CLOEXEC) == -1){
+		perror("hub: link pipes");
+		free(copy);
+		return(-1);
+	}
+	pid = fork();
+	if (pid < 0){
+		perror("Fork Failed");
+		free(copy);
+		return(-1);
+	} else if (pid == 0){  /* child process: the pipes are its standard input and output */
+		dup2(tranPipeFds[1], 1);
+		dup2(recPipeFds[0], 0);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		execv("/proc/self/exe", args);
+		perror("hub: execv");
+		exit(-1);
+	}
+	close(tranPipeFds[1]);
+	close(recPipeFds[0]);
+	free(copy);
+	snprintf(name, BUFSIZ, "hub %s", options);
+	return(attachLink(tranPipeFds[0], recPipeFds[1], pid, name, LINK_DOWN));
+}
+
+/*-------------------------------------------------------------
+Function: connectUplink
+Parameters:
+    path - Unix-domain socket of the uplink hub (its -L)
+Description:
+    Connects to another hub and attaches it as the uplink of this
+    hub; the socket is read with fdsTran and written with a
+    duplicate of it in fdsRec.  The connection is retried for a
+    while so that the hubs of a cascade can be started together.
+    Returns the slot of the link, or -1.
+-------------------------------------------------------------*/
+int connectUplink(char *path)
+{
+	struct sockaddr_un addr;
+	char name[BUFSIZ];
+	int fd;
+	int tries;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	for (tries = 0; fd != -1 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1; tries++)
+		if (tries == LINK_TRIES || (errno != ENOENT && errno != ECONNREFUSED)){
+			close(fd);
+			fd = -1;
+		}
+		else
+			usleep(LINK_TRY_USEC);
+	if (fd == -1){
+		perror(path);
+		return(-1);
+	}
+	snprintf(name, BUFSIZ, "uplink %s", path);
+	return(attachLink(fd, fcntl(fd, F_DUPFD_CLOEXEC, 0), 0, name, LINK_UP));
+}
+
+/*-------------------------------------------------------------
+Function: sendLink
+Parameters:
+    stn - slot of a link
+Description:
+    Sends a BIN_LINK frame to the other hub with the identifier of
+    this hub and that of the root of its tree (see handleLink()).
+-------------------------------------------------------------*/
+void sendLink(int stn)
+{
+	char frame[BIN_HDR_LEN + BIN_LINK_LEN];
+
+	memset(frame, 0, BIN_HDR_LEN);
+	frame[0] = BIN_MAGIC;
+	frame[BIN_VERSION_POS] = BIN_VERSION;
+	frame[BIN_TYPE_POS] = BIN_LINK;
+	BIN_PUT16(frame + BIN_LEN_POS, BIN_LINK_LEN);
+	BIN_PUT32(frame + BIN_HDR_LEN, hubId);
+	BIN_PUT32(frame + BIN_HDR_LEN + 4, rootId);
+	deliver(stn, frame, sizeof(frame), 1, nowUsec(), NULL);
+}
+
+/*-------------------------------------------------------------
+Function: announceRoot
+Parameters:
+    root - identifier of the root of the tree of this hub
+Description:
+    Records the root and sends it to the hubs below this one
+    (see sendLink()).
+-------------------------------------------------------------*/
+void announceRoot(unsigned root)
+{
+	int i;
+
+	rootId = root;
+	for (i=0; i<nStns; i++)
+		if (linkKind[i] == LINK_DOWN && fdsRec[i] != -1)
+			sendLink(i);
+}
+
+/*-------------------------------------------------------------
+Function: handleLink
+Parameters:
+    src   - slot that sent the frame
+    frame - BIN_LINK frame
+Description:
+    Loop prevention: the hubs of a cascade form a tree whose root
+    is the hub without an uplink; each hub announces the root of
+    its tree to the other end of its links.  A link is detached
+    when it would close a loop: an uplink whose root is this hub,
+    or a downlink already in the tree of this hub.  When the uplink
+    announces a new root, it is passed on to the hubs below.
+-------------------------------------------------------------*/
+void handleLink(int src, char *frame)
+{
+	unsigned id;
+	unsigned root;
+
+	if (linkKind[src] == LINK_NONE || BIN_GET16(frame + BIN_LEN_POS) < BIN_LINK_LEN){
+		fprintf(stderr,"hub: link frame dropped from fd %d\n",fdsTran[src]);
+		return;
+	}
+	id = BIN_GET32(frame + BIN_HDR_LEN);
+	root = BIN_GET32(frame + BIN_HDR_LEN + 4);
+	if (root == hubId || (linkKind[src] == LINK_DOWN && root == rootId)){
+		fprintf(stderr,"hub: link to hub %u would close a loop, detached\n",id);
+		detachStation(src);
+	}
+	else if (linkKind[src] == LINK_UP && root != rootId)
+		announceRoot(root);
+}
+
+/*-------------------------------------------------------------
+Function: learnId
+Parameters:
+    stn - slot of the station
+    id  - source identifier of a frame of the station
+Description:
+    Records the identifier the station transmits from and puts the
+    station in the groups that -G gives it to.  Called for the first
+    frame of the station and whenever its identifier changes; links
+    to other hubs carry the frames of many stations and are skipped.
+-------------------------------------------------------------*/
+void learnId(int stn, unsigned char id)
+{
+	int i;
+
+	stnIds[stn] = id;
+	for (i=0; i<N_GROUPS; i++)
+		if (groupConfig[i] != NULL && id != '\0' && strchr(groupConfig[i], id) != NULL)
+			joinGroup(stn, i);
+}
+
+/*-------------------------------------------------------------
+Function: joinGroup
+Parameters:
+    stn   - slot of the station
+    group - index of the group (its identifier - GROUP_FIRST)
+Description:
+    Adds the slot to the bitmap of the group, so that the frames
+    for the group are sent to it (see forwardRun()).  Called for
+    the join frames of the stations (see frame.h), for -G (see
+    learnId()) and for the links to other hubs (see fillSlot()).
+-------------------------------------------------------------*/
+void joinGroup(int stn, int group)
+{
+	atomic_fetch_or(&groupMembers[group][stn/32], 1u << (stn%32));
+}
+
+/*-------------------------------------------------------------
+Function: leaveGroups
+Parameters:
+    stn - slot of the station
+Description:
+    Removes the slot from the bitmaps of all groups.
+-------------------------------------------------------------*/
+void leaveGroups(int stn)
+{
+	int i;
+
+	for (i=0; i<N_GROUPS; i++)
+		atomic_fetch_and(&groupMembers[i][stn/32], ~(1u << (stn%32)));
 }
 
 /*--------------------------------------------------------------
 Function: createHubThreads
 Description:
-   Create 4 threads to listen on each T-pair pipe (i.e to the
-   fd's in dfsTran) with the function listenTran.
-   Once the threads have been created, sleep for 30 seconds and
-   then cancel (terminate) the threads.
+   Create a thread to listen on each T-pair pipe (i.e to the
+   fd's in fdsTran) with the function listenTran (see
+   startListening(); stations attached later get theirs at once).
+   With -q, another thread (drainRec()) writes the output queues of
+   the stations that were too slow.
+   Once the threads have been created, wait for the end of the run
+   (see hubFinished()): the threads of the stations drained have
+   terminated, the others (stations still running after DRAIN_SECS)
+   are cancelled.
 --------------------------------------------------------------*/
 void createHubThreads()
 {
-	int stations;
+	pthread_t drainer;  // thread of drainRec() (with -q)
 	int i;
-	
-	/*
-		Using same logic as in createStation, we use the location of  marker -1 in the array to determine the 
-		number of stations for which we have to create threads.
-	*/
-	for(stations=0 ; fdsRec[stations] != -1 ; ++stations)
-		if (stations+1 == MAX_STNS){
-			fprintf(stderr, "The hub has above its maximum # of %d stations. Will not create threads.", MAX_STNS);
+
+	if (queueLimit > 0){
+		drainFd = epoll_create1(EPOLL_CLOEXEC);
+		if (drainFd == -1 || pthread_create(&drainer, NULL, drainRec, NULL) != 0){
+			perror("hub: drainRec");
 			return;
 		}
-	
-	/*
-		Using the number of stations we will create an array of pthread_t types to store the threads created for each station.
-	*/	
-	pthread_t tid[stations];
-	pthread_attr_t attr;
-
-
-	pthread_attr_init(&attr);
-	for (i = 0; i < stations; i++){
-		pthread_create(&tid[i], &attr, listenTran, &fdsTran[i]);
-	}
-	// Sleep a bit
-	sleep(30);
-	// Cancel the threads
-	for (i=0; i<stations; i++){
-		pthread_cancel(tid[i]);
 	}
+	pthread_mutex_lock(&stnsLock);
+	listening = TRUE;
+	for (i = 0; i < nStns; i++)
+		if (fdsTran[i] != -1)
+			startListening(i);
+	pthread_mutex_unlock(&stnsLock);
+	while (!hubFinished())
+		usleep(END_CHECK * 1000);
+	// Cancel the threads left
+	pthread_mutex_lock(&stnsLock);
+	listening = FALSE;
+	for (i=0; i<nStns; i++)
+		if (hasListener[i])
+			pthread_cancel(listeners[i]);
+	pthread_mutex_unlock(&stnsLock);
+	if (queueLimit > 0)
+		pthread_cancel(drainer);
 }
 
 /*-------------------------------------------------------------------
@@ -225,43 +1307,1920 @@ Function: listenTran
 Description: 
    This function runs in a thread an listens to a station process
    on a transmission pipe (station transmits).  When data is read
-   from the pipe, it is copied into all reception pipes except for
-   the one attached to the process that sent the data.
+   from the pipe, the complete frames are copied into all reception
+   pipes except for the one attached to the process that sent the
+   data (see readTran()).  When the station closes its pipe, its
+   slot is freed with releaseStation().
 -------------------------------------------------------------------*/
 void *listenTran(void *fdListenPtr)
 {
-   int fdListen = *((int *) fdListenPtr);  // Get the fd on which to listen
+   int stn = (int *) fdListenPtr - fdsTran; // Get the station on which to listen
+   int fdListen = fdsTran[stn];            // Get the fd on which to listen
    int num;                                // value returned by read (num of bytes read)
-   char buffer[BUFSIZ];                    // buffer for reading data
-   int i;
+   char buffer[BUFSIZ];                    // buffer for error messages
    
    while(1)  // a loop
    {
-     num = read(fdListen,buffer,BUFSIZ-1);
-     if(num == -1) // error in reading 
+     num = readTran(stn);
+     if(num == -1 && errno == EAGAIN) // a socket shared with a non-blocking fdsRec (see attachLink())
+     {
+        struct pollfd pfd = {fdListen, POLLIN, 0};
+        poll(&pfd, 1, -1);
+     }
+     else if(num == -1) // error in reading 
      {
         sprintf(buffer,"Fatal error in reading on fd %d (%d)",fdListen,getpid());
 	perror(buffer);  			/* writes on standard error */
 	break;  				/* break the loop */
      }
-     else if(num == 0) /* other end of pipe closed - should not happen */
+     else if(num == 0) /* other end of pipe closed - the station is gone */
      {
 	sprintf(buffer,"Pipe closed (%d)\n",getpid());
         write(2,buffer,strlen(buffer)); 	// write to standard error
 	break;  				/* break the loop */
      }
-     else // ecrite dans le tuyaux de reception
-     {
-       buffer[num] = '\0';  			// terminate the string
-       // Following line can be used for debugging
-       //printf("hub: received frame from %d >%s<\n",fdListen,buffer);
-       for(i=0 ; fdsRec[i] != -1 ; i++)
-          if(fdsTran[i]!=fdListen) 
-          {
-               // Following line can be used for debugging
-               //printf("hub: transmitting frame to %d >%s<\n",fdsRec[i],buffer);
-	       write(fdsRec[i],buffer,strlen(buffer));
-          }
-     }
    }
+   releaseStation(stn);  // the slot can be reused
+   return(NULL);
+}
+
+/*-------------------------------------------------------------------
+Function: readTran
+Parameters:
+    stn - index of the station (in fdsTran) to read from
+Description:
+   Does one read on the transmission pipe of the station, appending
+   the data to its reassembly buffer, and then forwards the complete
+   frames with forwardFrames().  Returns the value returned by read(),
+   or by ringReadWait() with the shm transport (which blocks on or,
+   once made non-blocking, drains the eventfd in fdsTran).
+-------------------------------------------------------------------*/
+int readTran(int stn)
+{
+   struct reasmBuf *r = &reasmBufs[stn];
+   int num;
+
+   if(links[stn] != NULL)
+      num = ringReadWait(&links[stn]->up, r->data + r->len, BUFSIZ - r->len, wakeFds[stn], fdsTran[stn]);
+   else
+      num = read(fdsTran[stn], r->data + r->len, BUFSIZ - r->len);
+   STAT_ADD(&hubStats[stn], reads, 1);
+   if(num > 0)
+      forwardRead(stn, num);
+   else if(num == -1 && errno == EAGAIN)
+      STAT_ADD(&hubStats[stn], eagains, 1);
+   return(num);
+}
+
+/*-------------------------------------------------------------------
+Function: forwardRead
+Parameters:
+    stn - index of the station
+    num - number of bytes just read into its reassembly buffer
+Description:
+   Adds the bytes to the reassembly buffer of the station and
+   forwards the complete frames with forwardFrames().
+-------------------------------------------------------------------*/
+void forwardRead(int stn, int num)
+{
+   struct reasmBuf *r = &reasmBufs[stn];
+
+   STAT_ADD(&hubStats[stn], bytesIn, num);
+   r->readAt = nowUsec();
+   r->len += num;
+   forwardFrames(stn);
+}
+
+/*-------------------------------------------------------------------
+Function: forwardFrames
+Parameters:
+    src - index of the station that sent the data
+Description:
+   Scans the reassembly buffer of station src with scanFrames()
+   (FRAME_BATCH frames at a time) and forwards all complete frames
+   (text STX ... ETX or binary) with forwardRun().  Consecutive frames
+   with the same target (see frameTarget()) are forwarded together.
+   BIN_HELLO frames are answered by the hub (see answerHello()),
+   BIN_LINK frames are handled by handleLink(), join frames (see
+   frame.h) add the station to the group with joinGroup() and
+   binary frames of an unknown version are dropped.  Bytes that do
+   not start a frame are dropped (with a message on the standard
+   error).  An incomplete frame is moved to the start of the buffer
+   to wait for the rest of its bytes; a frame that does not fit in
+   the buffer is dropped.
+-------------------------------------------------------------------*/
+void forwardFrames(int src)
+{
+   struct reasmBuf *r = &reasmBufs[src];
+   struct frameRef refs[FRAME_BATCH];  // frames found by scanFrames()
+   char *pt = r->data;            // start of the bytes not scanned yet
+   char *end = r->data + r->len;  // end of the data in the buffer
+   char *run = pt;                // start of the complete frames not yet forwarded
+   int runTarget = FLOOD;         // target of the frames in the run
+   int runFrames = 0;             // number of frames in the run
+   int framesIn = 0;              // number of frames received
+   int target;                    // target of the frame
+   char *frame;                   // the frame
+   int len;                       // length of the frame
+   int n;                         // number of frames found
+   int consumed;                  // bytes covered by the frames found
+   int i;
+
+   do
+   {
+      n = scanFrames(pt, end - pt, refs, FRAME_BATCH, &consumed);
+      for(i=0; i<n; i++)
+      {
+         frame = pt + refs[i].offset;
+         len = refs[i].len;
+         if(refs[i].kind == FRAME_JUNK) // found an error - no STX
+         {
+            forwardRun(src, runTarget, run, frame - run, runFrames);
+            runFrames = 0;
+            fprintf(stderr,"hub: no STX, %d bytes dropped from fd %d\n",len,fdsTran[src]);
+            run = frame + len;
+         }
+         else if(refs[i].kind == FRAME_BIN
+                 && (frame[BIN_TYPE_POS] == BIN_HELLO || frame[BIN_TYPE_POS] == BIN_LINK
+                     || frame[BIN_VERSION_POS] != BIN_VERSION))
+         {  // frame for the hub, or that the stations cannot read
+            framesIn++;
+            forwardRun(src, runTarget, run, frame - run, runFrames);
+            runFrames = 0;
+            if(frame[BIN_TYPE_POS] == BIN_HELLO)
+               answerHello(src, frame);
+            else if(frame[BIN_TYPE_POS] == BIN_LINK)
+               handleLink(src, frame);
+            else
+               fprintf(stderr,"hub: binary frame of version %d dropped from fd %d\n",frame[BIN_VERSION_POS],fdsTran[src]);
+            run = frame + len;
+         }
+         else if(refs[i].kind == FRAME_TEXT && frame[SEP_POS] == JOIN_SEP && len == SEP_POS+2
+                 && IS_GROUP(refs[i].dest))
+         {  // join frame
+            framesIn++;
+            forwardRun(src, runTarget, run, frame - run, runFrames);
+            runFrames = 0;
+            joinGroup(src, refs[i].dest - GROUP_FIRST);
+            run = frame + len;
+         }
+         else  // complete frame
+         {
+            framesIn++;
+            target = frameTarget(src, frame, len);
+            if(target != runTarget)
+            {
+               forwardRun(src, runTarget, run, frame - run, runFrames);
+               run = frame;
+               runTarget = target;
+               runFrames = 0;
+            }
+            runFrames++;
+         }
+      }
+      pt += consumed;
+   } while(n == FRAME_BATCH);
+   forwardRun(src, runTarget, run, pt - run, runFrames);
+   STAT_ADD(&hubStats[src], framesIn, framesIn);
+   if (frameLimit > 0)
+      atomic_fetch_add_explicit(&framesForwarded, framesIn, memory_order_relaxed);
+
+   r->len = end - pt;
+   if(r->len == BUFSIZ)
+   {
+      fprintf(stderr,"hub: frame longer than %d bytes dropped from fd %d\n",BUFSIZ,fdsTran[src]);
+      r->len = 0;
+   }
+   memmove(r->data, pt, r->len);  // move the incomplete frame to the start of the buffer
+}
+
+/*-------------------------------------------------------------------
+Function: answerHello
+Parameters:
+    stn   - index of the station that sent the frame
+    hello - BIN_HELLO frame
+Description:
+   Answers the station with a BIN_HELLO frame holding the version of
+   the binary frames to use: the lowest of the version asked by the
+   station and the version accepted by the hub (binaryVersion, 0 when
+   the hub only forwards text frames, see -F).
+-------------------------------------------------------------------*/
+void answerHello(int stn, char *hello)
+{
+   char answer[BIN_HDR_LEN];
+
+   memset(answer, 0, BIN_HDR_LEN);
+   answer[0] = BIN_MAGIC;
+   answer[DEST_POS] = hello[SRC_POS];
+   answer[SRC_POS] = hello[SRC_POS];
+   answer[BIN_VERSION_POS] = hello[BIN_VERSION_POS] < binaryVersion ? hello[BIN_VERSION_POS] : binaryVersion;
+   answer[BIN_TYPE_POS] = BIN_HELLO;
+   deliver(stn, answer, BIN_HDR_LEN, 1, reasmBufs[stn].readAt, NULL);
+}
+
+/*-------------------------------------------------------------------
+Function: frameTarget
+Parameters:
+    src   - index of the station that sent the frame
+    frame - complete frame
+    len   - number of bytes in frame
+Description:
+   Returns the index of the station to which the frame must be sent,
+   FLOOD when it must be sent to all other stations, or GROUP_TARGET()
+   of a group for a group identifier.  The source identifier of each
+   station is recorded for -G (see learnId()).  When switching, the source identifier of the frame is learned as
+   belonging to station src, and a frame for a destination identifier
+   that has been learned is sent only to the station using it.
+   Without switching, or while the destination is unknown, frames
+   are flooded, as are those for BROADCAST_ID.
+-------------------------------------------------------------------*/
+int frameTarget(int src, char *frame, int len)
+{
+   unsigned char dest;
+   int stn;
+
+   if(len <= SRC_POS) return(FLOOD);
+   if((unsigned char) frame[SRC_POS] != stnIds[src] && linkKind[src] == LINK_NONE)
+      learnId(src, frame[SRC_POS]);
+   dest = frame[DEST_POS];
+   if(IS_GROUP(dest)) return(GROUP_TARGET(dest - GROUP_FIRST));
+   if(!switching || dest == BROADCAST_ID) return(FLOOD);
+   atomic_store_explicit(&learnedStn[(unsigned char) frame[SRC_POS]], src+1, memory_order_relaxed);
+   stn = atomic_load_explicit(&learnedStn[dest], memory_order_relaxed);
+   return(stn == 0 ? FLOOD : stn-1);
+}
+
+/*-------------------------------------------------------------------
+Function: forwardRun
+Parameters:
+    src    - index of the station that sent the frames
+    target - index of the station to receive the frames, FLOOD, or
+             GROUP_TARGET() of a group
+    frames - complete frames to forward
+    len    - number of bytes in frames
+    count  - number of frames
+Description:
+   Copies the frames into the reception pipe of the target station,
+   or, for FLOOD, into all reception pipes except for the one
+   attached to the process that sent the data.  For a group, only
+   the slots of its bitmap are visited (one word of 32 slots at a
+   time, see joinGroup()).  Frames are never
+   sent back to their source.  Each write is done with deliver(); the
+   output queues that must keep the frames share a single copy.  With
+   -c, the frames are then appended to the capture file with the
+   slots that received them.
+-------------------------------------------------------------------*/
+void forwardRun(int src, int target, char *frames, int len, int count)
+{
+   struct frameBuf *shared = NULL;  // copy of the frames in the output queues (made by the first)
+   unsigned members;                // slots of the group not visited yet in the current word
+   unsigned received[MAX_STNS/32];  // slots that received the frames (for the capture only)
+   int w;
+   int i;
+
+   if(len == 0) return;
+   if(capturePath != NULL)
+      memset(received, 0, sizeof(received));
+   // Following line can be used for debugging
+   //printf("hub: received frames from %d >%.*s<\n",fdsTran[src],len,frames);
+   if(target < FLOOD)  // the members of a group
+   {
+      for(w=0 ; w*32 < nStns ; w++)
+         for(members = atomic_load_explicit(&groupMembers[GROUP_TARGET(target)][w], memory_order_relaxed);
+             members != 0 ; members &= members-1)
+         {
+            i = w*32 + __builtin_ctz(members);
+            if(i != src && fdsRec[i] != -1)
+            {
+               deliver(i,frames,len,count,reasmBufs[src].readAt,&shared);
+               received[w] |= 1u << (i%32);
+            }
+         }
+   }
+   else
+      for(i=0 ; i < nStns ; i++)
+         if(i != src && fdsRec[i] != -1 && (target == FLOOD || i == target)) 
+         {
+              // Following line can be used for debugging
+              //printf("hub: transmitting frames to %d >%.*s<\n",fdsRec[i],len,frames);
+              deliver(i,frames,len,count,reasmBufs[src].readAt,&shared);
+              received[i/32] |= 1u << (i%32);
+         }
+   if(shared != NULL) poolRelease(shared);
+   if(capturePath != NULL)
+      captureRun(src, target, received, count, reasmBufs[src].readAt, frames, len);
+}
+
+/*-------------------------------------------------------------------
+Function: deliver
+Parameters:
+    stn    - index of the station to receive the frames
+    frames - complete frames
+    len    - number of bytes in frames
+    count  - number of frames
+    readAt - time (usec) at which the frames were read
+    shared - copy of the frames already queued for other stations
+             (see enqueueRun()), or NULL
+Description:
+   Writes the frames into the reception pipe of the station while
+   holding its lock or, when batching and in the uring mode (see
+   runUringLoop()), queues them with enqueueRun().
+   With a queue limit (-q), what the station has no space for is
+   queued and written by flushQueue() once it has, and the frames
+   that follow are queued behind it so that they keep their order.
+   The frames are counted (framesOut) once completely written, or
+   as dropped if the station is detached meanwhile.
+-------------------------------------------------------------------*/
+void deliver(int stn, char *frames, int len, int count, long long readAt, struct frameBuf **shared)
+{
+   struct outQueue *q = &outQueues[stn];
+   int num;
+
+   pthread_mutex_lock(&recLocks[stn]);
+   if(batchSize > 1 || q->count > 0 || hubMode == MODE_URING)
+   {
+      enqueueRun(stn,frames,len,count,readAt,shared);
+      if(q->count >= batchSize && !q->blocked) flushQueue(stn);
+   }
+   else if((num = writeRec(stn,frames,len)) < len)  // the station has no space for all of it
+   {
+      enqueueRun(stn,frames,len,count,readAt,shared);
+      q->iov[0].iov_base = (char *) q->iov[0].iov_base + num;  // skip the part written
+      q->iov[0].iov_len -= num;
+      flushQueue(stn);
+   }
+   else if(fdsRec[stn] == -1)  // detached before or by the write
+      STAT_ADD(&hubStats[stn], framesDropped, count);
+   else
+   {
+      STAT_ADD(&hubStats[stn], framesOut, count);
+      statsLatency(nowUsec() - readAt);
+   }
+   pthread_mutex_unlock(&recLocks[stn]);
+}
+
+/*-------------------------------------------------------------------
+Function: enqueueRun
+Parameters:
+    stn    - index of the station to receive the frames
+    frames - complete frames to queue
+    len    - number of bytes in frames
+    count  - number of frames
+    readAt - time (usec) at which the frames were read
+    shared - copy of the frames in the pool, made by the first queue
+             (*shared is NULL) and referenced by each queue; the
+             caller holds one more reference until all queues have
+             theirs.  NULL when the frames are for this station only
+Description:
+   Queues the frames in the output queue of the station (written
+   with flushQueue(), see deliver() and flushQueues()).
+   When the queue already holds queueLimit runs, the overflow policy
+   (-o) applies: drop-newest drops these frames, drop-oldest the
+   oldest run that has not been partly written, and disconnect
+   detaches the station (see closeRec()).  Dropped runs are counted
+   in drops, and their frames in framesDropped.  Called with the
+   lock of the station held.
+-------------------------------------------------------------------*/
+void enqueueRun(int stn, char *frames, int len, int count, long long readAt, struct frameBuf **shared)
+{
+   struct outQueue *q = &outQueues[stn];
+   struct frameBuf *own = NULL;  // copy when the frames are not shared
+   int first;   // oldest run that can be dropped
+
+   if(fdsRec[stn] == -1)  // detached
+   {
+      STAT_ADD(&hubStats[stn], framesDropped, count);
+      return;
+   }
+   if(queueLimit > 0 && q->count == queueLimit)
+   {
+      STAT_ADD(&hubStats[stn], drops, 1);
+      if(overflowPolicy == POLICY_DISCONNECT)
+      {
+         fprintf(stderr,"hub: output queue of station %d full, station disconnected\n",stn);
+         STAT_ADD(&hubStats[stn], framesDropped, count);
+         closeRec(stn);
+         return;
+      }
+      first = q->iov[0].iov_base != q->bufs[0]->data;  // part of the first run is in the pipe already
+      if(first < q->inFlight) first = q->inFlight;  // being written by the ring
+      if(overflowPolicy == POLICY_DROP_NEWEST || first == q->count)
+      {
+         STAT_ADD(&hubStats[stn], framesDropped, count);
+         return;
+      }
+      STAT_ADD(&hubStats[stn], framesDropped, q->frames[first]);
+      poolRelease(q->bufs[first]);
+      q->count--;
+      memmove(q->bufs + first, q->bufs + first + 1, (q->count - first) * sizeof(struct frameBuf *));
+      memmove(q->iov + first, q->iov + first + 1, (q->count - first) * sizeof(struct iovec));
+      memmove(q->readAt + first, q->readAt + first + 1, (q->count - first) * sizeof(long long));
+      memmove(q->frames + first, q->frames + first + 1, (q->count - first) * sizeof(int));
+   }
+   if(shared == NULL) shared = &own;
+   if(*shared == NULL && (*shared = poolGet(frames, len)) == NULL)
+   {
+      fprintf(stderr,"hub: no frame buffer for %d bytes\n",len);
+      STAT_ADD(&hubStats[stn], framesDropped, count);
+      return;
+   }
+   poolRef(*shared);  // the reference of this queue
+   if(own != NULL) poolRelease(own);  // the queue is the only one holding it
+   if(q->count == 0) q->since = nowUsec();
+   q->bufs[q->count] = *shared;
+   q->iov[q->count].iov_base = (*shared)->data;
+   q->iov[q->count].iov_len = len;
+   q->readAt[q->count] = readAt;
+   q->frames[q->count] = count;
+   q->count++;
+   statsQueue(&hubStats[stn], q->count);
+}
+
+/*-------------------------------------------------------------------
+Function: flushQueue
+Parameters:
+    stn - index of the station whose output queue is written
+Description:
+   Writes the runs waiting in the output queue of the station into
+   its reception pipe with writev(), restarting after short writes,
+   and frees them.  With the shm transport, the runs are copied into
+   the reception ring one after the other.  The runs of a station
+   that has been detached are dropped.  The frames of each run are
+   counted once it is completely written, the bytes as they are.
+   With a queue limit (-q), the pipe is non-blocking: the runs it has
+   no space for stay in the queue and the pipe (or the eventfd
+   signaled when the station frees space in its ring) is watched by
+   drainFd until they are written (see watchRec() and drainQueue()).
+   In the uring mode, the queue is written by the ring (postQueue());
+   another thread leaves it to the loop.
+   Called with the lock of the station held.
+-------------------------------------------------------------------*/
+void flushQueue(int stn)
+{
+   struct outQueue *q = &outQueues[stn];
+   struct iovec *iov = q->iov;  // first run not completely written
+   int left = q->count;         // number of runs not completely written
+   int gone = FALSE;            // TRUE when the station has closed its pipe
+   int lost = FALSE;            // TRUE when the runs left are dropped
+   ssize_t num;
+   long long now;
+   int done;
+   int i;
+
+   if(hubMode == MODE_URING)
+   {
+      if(pthread_equal(pthread_self(), uringThread))
+         postQueue(stn);
+      else
+      {
+         atomic_store(&uringNew, TRUE);
+         eventSignal(uringWakeFd);
+      }
+      return;
+   }
+   if(links[stn] != NULL && fdsRec[stn] != -1)
+   {
+      for( ; left > 0 ; iov++, left--)
+      {
+         if((num = writeRec(stn, iov->iov_base, iov->iov_len)) < (ssize_t) iov->iov_len)  // the ring is full
+         {
+            iov->iov_base = (char *) iov->iov_base + num;
+            iov->iov_len -= num;
+            break;
+         }
+         STAT_ADD(&hubStats[stn], framesOut, q->frames[q->count - left]);
+      }
+   }
+   while(left > 0 && links[stn] == NULL && fdsRec[stn] != -1)
+   {
+      num = writev(fdsRec[stn], iov, left);
+      STAT_ADD(&hubStats[stn], writes, 1);
+      if(num == -1)
+      {
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN)
+         {
+            STAT_ADD(&hubStats[stn], eagains, 1);
+            break;
+         }
+         perror("hub: writev");
+         gone = errno == EPIPE;
+         lost = TRUE;
+         break;
+      }
+      STAT_ADD(&hubStats[stn], bytesOut, num);
+      while(left > 0 && num >= (ssize_t) iov->iov_len)  // skip the runs written
+      {
+         STAT_ADD(&hubStats[stn], framesOut, q->frames[q->count - left]);
+         num -= iov->iov_len;
+         iov++;
+         left--;
+      }
+      if(left > 0)  // part of a run was written
+      {
+         STAT_ADD(&hubStats[stn], shortWrites, 1);
+         iov->iov_base = (char *) iov->iov_base + num;
+         iov->iov_len -= num;
+      }
+   }
+   if(fdsRec[stn] == -1 || lost)  // detached or failed: the runs left are dropped
+      for( ; left > 0 ; iov++, left--)
+         STAT_ADD(&hubStats[stn], framesDropped, q->frames[q->count - left]);
+   now = nowUsec();
+   done = q->count - left;
+   for(i=0; i<done; i++)
+   {
+      poolRelease(q->bufs[i]);
+      statsLatency(now - q->readAt[i]);
+   }
+   memmove(q->bufs, q->bufs + done, left * sizeof(struct frameBuf *));  // keep the runs not written
+   memmove(q->iov, iov, left * sizeof(struct iovec));
+   memmove(q->readAt, q->readAt + done, left * sizeof(long long));
+   memmove(q->frames, q->frames + done, left * sizeof(int));
+   q->count = left;
+   statsQueue(&hubStats[stn], left);
+   if(gone)
+      closeRec(stn);
+   else if(left > 0 && !q->blocked)
+      watchRec(stn, TRUE);
+   else if(left == 0 && q->blocked)
+      watchRec(stn, FALSE);
+}
+
+/*-------------------------------------------------------------------
+Function: flushQueues
+Parameters:
+    force - TRUE to write all queues whatever their age
+Description:
+   Writes the output queues whose first run has waited at least
+   flushDelay microseconds (all non-empty queues when force is TRUE).
+   Queues waiting for space in their pipe are left to drainQueue().
+   Returns the time (usec) at which the next queue is due, or -1 if
+   all queues are empty.
+-------------------------------------------------------------------*/
+long long flushQueues(int force)
+{
+   long long now = nowUsec();
+   long long next = -1;  // time at which the next queue is due
+   long long due;
+   int i;
+
+   for(i=0 ; i < nStns ; i++)
+      if(outQueues[i].count > 0 && !outQueues[i].blocked)
+      {
+         due = outQueues[i].since + flushDelay;
+         if(force || due <= now)
+         {
+            pthread_mutex_lock(&recLocks[i]);
+            flushQueue(i);
+            pthread_mutex_unlock(&recLocks[i]);
+         }
+         else if(next == -1 || due < next)
+            next = due;
+      }
+   return(next);
+}
+
+/*-------------------------------------------------------------------
+Function: watchRec
+Parameters:
+    stn - index of the station
+    on  - TRUE to start watching, FALSE to stop
+Description:
+   Adds the reception pipe of the station to drainFd (for EPOLLOUT)
+   or removes it; with the shm transport, the eventfd signaled when
+   the station frees space in its ring (fdsRec) is watched for
+   EPOLLIN instead.  The events carry MAX_STNS + stn so that they
+   are told apart from those of the transmission pipes.  Sets the
+   blocked flag of the output queue.  Called with the lock of the
+   station held.
+-------------------------------------------------------------------*/
+void watchRec(int stn, int on)
+{
+   struct epoll_event ev;
+
+   outQueues[stn].blocked = on;
+   if(drainFd == -1) return;  // the hub does not forward anymore
+   ev.events = links[stn] != NULL ? EPOLLIN : EPOLLOUT;
+   ev.data.u32 = MAX_STNS + stn;
+   if(epoll_ctl(drainFd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fdsRec[stn], &ev) == -1)
+      perror("hub: epoll_ctl");
+}
+
+/*-------------------------------------------------------------------
+Function: drainQueue
+Parameters:
+    stn - index of the station
+Description:
+   Called when drainFd reports that the station has space in its
+   reception pipe (or ring): writes its output queue with
+   flushQueue(), which stops watching the pipe once it is empty.
+-------------------------------------------------------------------*/
+void drainQueue(int stn)
+{
+   unsigned long long n;
+
+   pthread_mutex_lock(&recLocks[stn]);
+   if(links[stn] != NULL && fdsRec[stn] != -1)
+      read(fdsRec[stn], &n, sizeof(n));  // reset the eventfd (non-blocking)
+   if(outQueues[stn].blocked)
+      flushQueue(stn);
+   pthread_mutex_unlock(&recLocks[stn]);
+}
+
+/*-------------------------------------------------------------------
+Function: drainRec
+Description:
+   Runs in its own thread in the threads and pool modes with a queue limit
+   (-q): waits on drainFd and drains the output queues of the
+   stations that have space again (see drainQueue()).  It is not
+   cancelled while it holds the lock of a station.
+-------------------------------------------------------------------*/
+void *drainRec(void *unused)
+{
+   struct epoll_event events[MAX_STNS];  // reception pipes reported ready
+   int ready;
+   int i;
+
+   (void) unused;
+   while(1)
+   {
+      ready = epoll_wait(drainFd, events, MAX_STNS, -1);
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+      for(i=0; i<ready; i++)
+         drainQueue(events[i].data.u32 - MAX_STNS);
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+   }
+   return(NULL);
+}
+
+/*-------------------------------------------------------------------
+Function: nowUsec
+Description:
+   Returns the time of the monotonic clock in microseconds.
+-------------------------------------------------------------------*/
+long long nowUsec()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+}
+
+/*-------------------------------------------------------------------
+Function: waitEvents
+Parameters:
+    efd     - epoll instance
+    events  - where the ready pipes are stored
+    max     - size of events
+    timeout - longest wait in microseconds
+Description:
+   epoll_wait() with a timeout in microseconds, so that the -d
+   delay is not rounded up to whole milliseconds: uses
+   epoll_pwait2(), or epoll_wait() if the kernel lacks it (before
+   Linux 5.11).  Returns as epoll_wait() does.
+-------------------------------------------------------------------*/
+int waitEvents(int efd, struct epoll_event *events, int max, long long timeout)
+{
+   static int noPwait2 = FALSE;  // epoll_pwait2() returned ENOSYS
+   struct timespec ts;
+   int ready;
+
+   if(timeout < 0) timeout = 0;
+   if(!noPwait2)
+   {
+      ts.tv_sec = timeout / 1000000;
+      ts.tv_nsec = (timeout % 1000000) * 1000;
+      ready = epoll_pwait2(efd, events, max, &ts, NULL);
+      if(ready != -1 || errno != ENOSYS)
+         return(ready);
+      noPwait2 = TRUE;
+   }
+   return(epoll_wait(efd, events, max, (timeout + 999) / 1000));
+}
+
+/*-------------------------------------------------------------------
+Function: writeRec
+Parameters:
+    stn  - index of the station to receive the data
+    data - bytes to write
+    len  - number of bytes to write
+Description:
+   Writes all len bytes into the reception pipe of the station with
+   writeAll(), or into its reception ring with the shm transport
+   (waiting on the eventfd in fdsRec while the ring is full).
+   With a queue limit (-q), it does not wait: it writes what the
+   pipe (or ring) has space for.  A write that found the pipe or
+   the ring full counts as a backpressure event (eagains).
+   Nothing is written to a station that has been detached, and a
+   station that has closed its pipe is detached (see closeRec()).
+   The bytes written are counted (bytesOut).
+   Returns the number of bytes written or dropped.  Called with the
+   lock of the station held.
+-------------------------------------------------------------------*/
+int writeRec(int stn, char *data, int len)
+{
+   int calls;
+   int num;
+
+   if(fdsRec[stn] == -1) return(len);
+   if(links[stn] == NULL && queueLimit > 0)
+   {
+      do num = write(fdsRec[stn], data, len); while(num == -1 && errno == EINTR);
+      STAT_ADD(&hubStats[stn], writes, 1);
+      if(num == -1 && errno == EAGAIN)
+      {
+         STAT_ADD(&hubStats[stn], eagains, 1);
+         return(0);
+      }
+      if(num == -1)
+      {
+         perror("hub: write");
+         if(errno == EPIPE) closeRec(stn);
+         return(len);
+      }
+      if(num < len) STAT_ADD(&hubStats[stn], shortWrites, 1);
+      STAT_ADD(&hubStats[stn], bytesOut, num);
+      return(num);
+   }
+   if(links[stn] == NULL)
+   {
+      num = writeAll(fdsRec[stn], data, len, &calls);
+      STAT_ADD(&hubStats[stn], writes, calls);
+      STAT_ADD(&hubStats[stn], shortWrites, calls - 1);
+      STAT_ADD(&hubStats[stn], bytesOut, num);
+      if(num < len && errno == EPIPE) closeRec(stn);
+      return(len);
+   }
+   num = ringWrite(&links[stn]->down, data, len, wakeFds[stn]);
+   STAT_ADD(&hubStats[stn], writes, 1);
+   if(num < len)
+   {
+      STAT_ADD(&hubStats[stn], shortWrites, 1);
+      STAT_ADD(&hubStats[stn], eagains, 1);
+      if(queueLimit > 0)
+      {
+         atomic_store(&links[stn]->down.spaceWaiting, 1);
+         // check again: the station may have read before seeing the flag
+         num += ringWrite(&links[stn]->down, data + num, len - num, wakeFds[stn]);
+         STAT_ADD(&hubStats[stn], bytesOut, num);
+         return(num);
+      }
+      if(ringWriteAll(&links[stn]->down, data + num, len - num, wakeFds[stn], fdsRec[stn]) == -1)
+      {
+         perror("hub: ringWriteAll");
+         STAT_ADD(&hubStats[stn], bytesOut, num);
+         return(len);
+      }
+   }
+   STAT_ADD(&hubStats[stn], bytesOut, len);
+   return(len);
+}
+
+/*-------------------------------------------------------------------
+Function: closeStations
+Description:
+   Closes the reception rings of the stations connected with the
+   shm transport, so that they terminate as they do when the write
+   ends of their reception pipes are closed.  The locks are not
+   taken: a cancelled thread may still hold one.
+-------------------------------------------------------------------*/
+void closeStations()
+{
+   int i;
+
+   for(i=0 ; i < nStns ; i++)
+      if(links[i] != NULL && fdsRec[i] != -1)
+         ringClose(&links[i]->down, wakeFds[i]);
+}
+
+/*-------------------------------------------------------------------
+Function: writeAll
+Parameters:
+    fd   - file descriptor to write to
+    data - bytes to write
+    len  - number of bytes to write
+Description:
+   Writes all len bytes, restarting after short writes and
+   interruptions, and waiting if the fd is non-blocking.  Returns the number of bytes written (len unless
+   write() failed) and stores the number of calls to write() in
+   *calls (1 when nothing went wrong).
+-------------------------------------------------------------------*/
+int writeAll(int fd, char *data, int len, int *calls)
+{
+   int num;
+   int done = 0;
+
+   *calls = 0;
+   while(done < len)
+   {
+      num = write(fd, data + done, len - done);
+      (*calls)++;
+      if(num == -1)
+      {
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN)  // a socket shared with a non-blocking fdsTran (see attachLink())
+         {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+            continue;
+         }
+         perror("hub: write");
+         return(done);
+      }
+      done += num;
+   }
+   return(done);
+}
+
+/*-------------------------------------------------------------------
+Function: startService
+Description:
+   Creates the thread serving the statistics, the control
+   commands and the links (serveHub()), after creating the
+   Unix-domain sockets statsPath, controlPath and linkPath if -S,
+   -C and -L were given.  The thread
+   is detached and ends with the hub.
+-------------------------------------------------------------------*/
+void startService()
+{
+   static int fdsListen[3] = {-1, -1, -1};  // statistics, control and link sockets (given to the thread)
+   pthread_t tid;
+
+   if(statsPath != NULL)
+      fdsListen[0] = openSocket(statsPath);
+   if(controlPath != NULL)
+      fdsListen[1] = openSocket(controlPath);
+   if(linkPath != NULL)
+      fdsListen[2] = openSocket(linkPath);
+   if(pthread_create(&tid, NULL, serveHub, fdsListen) != 0)
+      perror("hub: service thread");
+   else
+      pthread_detach(tid);
+}
+
+/*-------------------------------------------------------------------
+Function: openSocket
+Parameters:
+    path - path of the socket
+Description:
+   Creates a Unix-domain socket listening on path (replacing any
+   file left there).  Returns its fd, or -1 if it cannot be created.
+-------------------------------------------------------------------*/
+int openSocket(char *path)
+{
+   struct sockaddr_un addr;
+   int fd;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+   unlink(path);
+   fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+      || listen(fd, 4) == -1)
+   {
+      perror(path);
+      if(fd != -1) close(fd);
+      return(-1);
+   }
+   return(fd);
+}
+
+/*-------------------------------------------------------------------
+Function: serveHub
+Parameters:
+    fdsListenPtr - points to the statistics, the control and the
+                   link sockets (-1 if none)
+Description:
+   Runs in its own thread: prints the statistics on the standard
+   error every statsInterval seconds, writes them to each client
+   that connects to the statistics socket (e.g. with
+   "socat - UNIX-CONNECT:path"), closing the connection after, and
+   serves each client of the control socket with handleControl().
+   A hub connecting to the link socket is attached as a hub below
+   this one (see attachLink()).
+   Also reaps the stations that have terminated, keeping the status
+   of each against its slot (exitPids, exitStatus).
+   Only reads the counters, so it never slows the forwarding.
+-------------------------------------------------------------------*/
+void *serveHub(void *fdsListenPtr)
+{
+   struct pollfd pfds[3];
+   long long next = nowUsec() + statsInterval * 1000000LL;  // time of the next print
+   int timeout;
+   int status;
+   int pid;
+   int fd;
+   int i;
+
+   for(i=0; i<3; i++)
+   {
+      pfds[i].fd = ((int *) fdsListenPtr)[i];  // poll() ignores -1
+      pfds[i].events = POLLIN;
+   }
+   while(1)
+   {
+      timeout = statsInterval > 0 ? (next - nowUsec() + 999) / 1000 : 1000;
+      if(timeout < 0) timeout = 0;
+      if(timeout > 1000) timeout = 1000;
+      if(poll(pfds, 3, timeout) > 0)
+         for(i=0; i<3; i++)
+            if(pfds[i].revents & POLLIN)
+            {
+               fd = accept4(pfds[i].fd, NULL, NULL, SOCK_CLOEXEC);
+               if(fd == -1) continue;
+               if(i == 2)
+               {
+                  attachLink(fd, fcntl(fd, F_DUPFD_CLOEXEC, 0), 0, "downlink", LINK_DOWN);
+                  continue;
+               }
+               if(i == 0)
+                  dumpStats(fd);
+               else
+                  handleControl(fd);
+               close(fd);
+            }
+      // stations that have terminated: their status is kept for endStations() (see reapStation())
+      pthread_mutex_lock(&stnsLock);
+      while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+         for(i=0; i<nStns; i++)
+            if(pids[i] == pid)
+            {
+               exitPids[i] = pid;
+               exitStatus[i] = status;
+            }
+      pthread_mutex_unlock(&stnsLock);
+      if(statsInterval > 0 && nowUsec() >= next)
+      {
+         dumpStats(2);
+         next += statsInterval * 1000000LL;
+      }
+   }
+   return(NULL);
+}
+
+/*-------------------------------------------------------------------
+Function: handleControl
+Parameters:
+    fd - connection of a client of the control socket
+Description:
+   Reads commands from the client, one per line, and answers each
+   with one line (or with one line per station for list):
+      attach <config>  - creates a station with the configuration
+                         file (see createStation()); answers
+                         "attached <slot> pid <pid>"
+      detach <slot>    - detaches the station (see detachStation());
+                         its slot is freed once it has terminated
+      list             - "<slot> <pid> <config>" for each station
+      stats            - the statistics (see dumpStats())
+   Errors are answered with "error: ...".  The connection is
+   closed by the client, or after CONTROL_TIMEOUT seconds without
+   a command.
+-------------------------------------------------------------------*/
+void handleControl(int fd)
+{
+   struct timeval tv = {CONTROL_TIMEOUT, 0};
+   char line[PATH_MAX + 16];
+   char arg[PATH_MAX];
+   FILE *fp;
+   int stn;
+   int i;
+
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+   fp = fdopen(fcntl(fd, F_DUPFD_CLOEXEC, 0), "r");
+   if(fp == NULL)
+   {
+      perror("hub: control");
+      return;
+   }
+   while(fgets(line, sizeof(line), fp) != NULL)
+   {
+      if(sscanf(line, "attach %s", arg) == 1)
+      {
+         stn = createStation(arg);
+         if(stn == -1)
+            dprintf(fd, "error: cannot attach %s\n", arg);
+         else
+            dprintf(fd, "attached %d pid %d\n", stn, pids[stn]);
+      }
+      else if(sscanf(line, "detach %d", &stn) == 1)
+      {
+         if(detachStation(stn))
+            dprintf(fd, "detached %d\n", stn);
+         else
+            dprintf(fd, "error: no station in slot %d\n", stn);
+      }
+      else if(strncmp(line, "list", 4) == 0)
+      {
+         pthread_mutex_lock(&stnsLock);
+         for(i=0; i<nStns; i++)
+            if(fdsTran[i] != -1)
+               dprintf(fd, "%d %d %s%s\n", i, pids[i], configs[i], fdsRec[i] == -1 ? " (detached)" : "");
+         pthread_mutex_unlock(&stnsLock);
+      }
+      else if(strncmp(line, "stats", 5) == 0)
+         dumpStats(fd);
+      else
+         dprintf(fd, "error: unknown command (attach <config>, detach <slot>, list, stats)\n");
+   }
+   fclose(fp);
+}
+
+/*-------------------------------------------------------------------
+Function: stopHub
+Parameters:
+    sig - the signal (SIGINT or SIGTERM)
+Description:
+   Ends the run: the stations are drained as when runTime seconds
+   have passed (see hubFinished()).  A second signal ends the hub
+   at once.
+-------------------------------------------------------------------*/
+void stopHub(int sig)
+{
+   if(stopSignal != 0)
+      _exit(-1);
+   stopSignal = sig;
+}
+
+/*-------------------------------------------------------------------
+Function: hubFinished
+Description:
+   Called by the thread running the hub mode at least every
+   END_CHECK msecs.  While the hub forwards traffic, checks whether
+   the run is over: runTime seconds have passed, frameLimit frames
+   were forwarded (-n), no data arrived for idleTime seconds (-I) or
+   a signal was received (stopHub()).  The hub then drains the
+   stations while it goes on serving them: the reception pipes are
+   closed in slot order (see detachStation()), each one once its
+   output queue is written (or after FLUSH_MSECS), and a station that
+   sees the end of its pipe terminates, which closes its transmission
+   pipe and frees its slot.  A hub below this one (-H) is sent
+   SIGTERM, so that it drains its own stations.
+   Returns TRUE once all slots are free, or DRAIN_SECS after the
+   drain started.
+-------------------------------------------------------------------*/
+int hubFinished()
+{
+   static long long started = 0;        // when the hub started forwarding (usec)
+   static long long checked;            // when the run was last checked
+   static long long lastActive;         // when data was last read from a station
+   static unsigned long long lastBytes = 0;  // bytes read from the stations until then
+   unsigned long long bytes = 0;
+   long long now = nowUsec();
+   char *reason = NULL;
+   int busy = FALSE;                    // TRUE while a slot is in use
+   int i;
+
+   if(started == 0)
+      started = checked = lastActive = now;
+   if(now - checked < END_CHECK * 1000LL) return(FALSE);
+   checked = now;
+   if(drainStart == 0)
+   {
+      for(i=0; i<nStns; i++)
+         bytes += atomic_load(&hubStats[i].bytesIn);
+      if(bytes != lastBytes)
+      {
+         lastBytes = bytes;
+         lastActive = now;
+      }
+      if(stopSignal != 0)
+         reason = stopSignal == SIGINT ? "interrupted" : "terminated";
+      else if(now - started >= runTime * 1000000LL)
+         reason = "run time over";
+      else if(frameLimit > 0 && atomic_load(&framesForwarded) >= (unsigned long long) frameLimit)
+         reason = "frame limit reached";
+      else if(idleTime > 0 && now - lastActive >= idleTime * 1000000LL)
+         reason = "idle";
+      if(reason == NULL) return(FALSE);
+      fprintf(stderr,"hub (%d): %s, draining the stations\n",getpid(),reason);
+      drainStart = now;
+   }
+   for(i=0; i<nStns; i++)
+   {
+      if(fdsTran[i] == -1) continue;
+      busy = TRUE;
+      if(fdsRec[i] == -1) continue;  // already closed
+      if(atomic_load(&hubStats[i].queueDepth) > 0 && now - drainStart < FLUSH_MSECS * 1000LL)
+         break;  // the next ones wait for this one
+      pthread_mutex_lock(&stnsLock);
+      if(fdsTran[i] != -1 && endNames[i] == NULL)
+      {
+         endPids[i] = linkKind[i] == LINK_UP ? 0 : pids[i];  // the hub above is not a child
+         endNames[i] = strdup(configs[i]);
+      }
+      pthread_mutex_unlock(&stnsLock);
+      if(linkKind[i] != LINK_NONE)
+         shutdown(fdsRec[i], SHUT_WR);  // the socket is shared with fdsTran
+      if(linkKind[i] == LINK_DOWN && pids[i] > 0)
+         kill(pids[i], SIGTERM);
+      detachStation(i);
+   }
+   return(!busy || now - drainStart >= DRAIN_SECS * 1000000LL);
+}
+
+/*-------------------------------------------------------------------
+Function: endStations
+Description:
+   Called once the hub has stopped forwarding: waits for the
+   processes of the stations drained by hubFinished() (waitpid()),
+   killing those still running after DRAIN_SECS, and prints what the
+   hub forwarded from and to each of them: the frames it read, those
+   wrote to it completely (framesOut) and those it took for it but
+   dropped, so that the two add up to all the frames forwarded to it.
+-------------------------------------------------------------------*/
+void endStations()
+{
+   long long deadline = nowUsec() + DRAIN_SECS * 1000000LL;
+   char how[64];
+   int status;
+   int ret;
+   int i;
+
+   for(i=0; i<nStns; i++)
+   {
+      if(endNames[i] == NULL) continue;
+      if(endPids[i] <= 0)
+         strcpy(how, "not a child");
+      else
+      {
+         while((ret = reapStation(i, &status)) == 0 && nowUsec() < deadline)
+            usleep(END_CHECK * 1000);
+         if(ret == 0)
+         {
+            kill(endPids[i], SIGKILL);
+            while((ret = reapStation(i, &status)) == 0)
+               usleep(END_CHECK * 1000);
+         }
+         if(ret == -1)
+            strcpy(how, "status unknown");
+         else if(WIFEXITED(status))
+            sprintf(how, "exit status %d", WEXITSTATUS(status));
+         else
+            sprintf(how, "killed by signal %d", WTERMSIG(status));
+      }
+      fprintf(stderr,"hub (%d): slot %d %s (pid %d, %s): %llu frames (%llu bytes) sent, %llu frames (%llu bytes) delivered, %llu frames dropped (%llu runs by -o)\n",
+              getpid(), i, endNames[i], endPids[i], how,
+              atomic_load(&hubStats[i].framesIn), atomic_load(&hubStats[i].bytesIn),
+              atomic_load(&hubStats[i].framesOut), atomic_load(&hubStats[i].bytesOut),
+              atomic_load(&hubStats[i].framesDropped), atomic_load(&hubStats[i].drops));
+   }
+}
+
+/*-------------------------------------------------------------------
+Function: reapStation
+Parameters:
+    stn    - slot of a station drained (endPids[stn] > 0)
+    status - where the status of its process is stored
+Description:
+   Returns the process of the station once it has terminated, with
+   its status, whether it is reaped here (waitpid()) or was by
+   serveHub() before; 0 while it runs, -1 on error.
+-------------------------------------------------------------------*/
+int reapStation(int stn, int *status)
+{
+   int ret;
+
+   pthread_mutex_lock(&stnsLock);  // serveHub() reaps and records under it
+   if(exitPids[stn] == endPids[stn])
+   {
+      *status = exitStatus[stn];
+      ret = endPids[stn];
+   }
+   else
+      ret = waitpid(endPids[stn], status, WNOHANG);
+   pthread_mutex_unlock(&stnsLock);
+   return(ret);
+}
+
+/*-------------------------------------------------------------------
+Function: dumpStats
+Parameters:
+    fd - file descriptor to print to
+Description:
+   Prints the counters of all stations (see statsDump()); free
+   slots are skipped.  Then prints the use of the frame pool.
+-------------------------------------------------------------------*/
+void dumpStats(int fd)
+{
+   statsDump(fd, hubStats, fdsTran, nStns);
+   poolDump(fd);
+}
+
+/*-------------------------------------------------------------------
+Function: runEventLoop
+
+Description:
+   Serves all stations from the calling thread.  The transmission
+   pipes are made non-blocking and registered with one epoll
+   instance; each time epoll_wait() reports ready pipes, readTran()
+   is called once per ready pipe.  After each turn of the loop the
+   output queues that are due are written (see flushQueues()) and
+   the loop only waits until the next queue is due, to the
+   microsecond (see waitEvents()).  With -q,
+   the pipes of the queues waiting for space are in the same epoll
+   set (see watchRec()).
+   Stations attached while the loop runs are added to the epoll set
+   (see startListening()); a station whose pipe is closed is removed
+   from it and its slot freed (see releaseStation()).
+   Returns at the end of the run, once the stations are drained (see
+   hubFinished()) and all queues are written.
+-------------------------------------------------------------------*/
+void runEventLoop()
+{
+	int efd;                                // epoll instance
+	struct epoll_event events[MAX_STNS];    // pipes reported ready
+	char buffer[BUFSIZ];                    // buffer for error messages
+	long long wakeup;                       // when waitEvents must return (usec)
+	long long due;                          // when the next output queue is due (usec)
+	int ready;                              // number of ready pipes
+	int num;                                // value returned by read
+	int stn;
+	int i;
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd == -1){
+		perror("hub: epoll_create1");
+		return;
+	}
+	placeWorker(pthread_self(), -1);
+	pthread_mutex_lock(&stnsLock);
+	loopFd = efd;
+	drainFd = efd;
+	listening = TRUE;
+	for (i=0 ; i < nStns ; i++)
+		if (fdsTran[i] != -1)
+			startListening(i);
+	pthread_mutex_unlock(&stnsLock);
+
+	due = -1;
+	while (!hubFinished()){
+		wakeup = nowUsec() + END_CHECK * 1000LL;
+		if (due != -1 && due < wakeup) wakeup = due;
+		ready = waitEvents(efd, events, MAX_STNS, wakeup - nowUsec());
+		if (ready == -1){
+			if (errno == EINTR) continue;
+			perror("hub: epoll_wait");
+			break;
+		}
+		for (i=0; i<ready; i++){
+			stn = events[i].data.u32;
+			if (stn >= MAX_STNS){  // a reception pipe has space again
+				drainQueue(stn - MAX_STNS);
+				continue;
+			}
+			num = readTran(stn);
+			if (num == 0 || (num == -1 && errno != EAGAIN)){
+				/* other end of pipe closed or fatal error - stop listening to this station */
+				if (num == -1){
+					sprintf(buffer,"Fatal error in reading on fd %d (%d)",fdsTran[stn],getpid());
+					perror(buffer);
+				}
+				else
+					fprintf(stderr,"Pipe closed (%d)\n",getpid());
+				releaseStation(stn);
+			}
+		}
+		due = flushQueues(FALSE);
+	}
+	flushQueues(TRUE);
+	pthread_mutex_lock(&stnsLock);
+	loopFd = -1;
+	drainFd = -1;
+	listening = FALSE;
+	pthread_mutex_unlock(&stnsLock);
+	close(efd);
+}
+
+/*-------------------------------------------------------------------
+Function: runWorkerPool
+Description:
+   Serves all stations with nWorkers threads (runWorker()).  Each
+   worker has its own epoll instance holding the transmission pipes
+   of its shard of the slots (slot i belongs to worker i % nWorkers,
+   see startListening()), registered with EPOLLONESHOT so that a pipe
+   reported ready is read by one worker at a time.  With -q, the
+   drainRec() thread writes the output queues of the stations that
+   were too slow, as in the threads mode.
+   Returns at the end of the run (see hubFinished()), once the
+   workers have stopped (a worker still blocked writing to a station
+   after POOL_JOIN_SECS is cancelled, as the threads of
+   createHubThreads() are).
+-------------------------------------------------------------------*/
+void runWorkerPool()
+{
+	struct epoll_event ev;
+	struct timespec limit;
+	pthread_t drainer;  // thread of drainRec() (with -q)
+	int i;
+
+	workers = calloc(nWorkers, sizeof(struct worker));
+	if (workers == NULL){
+		perror("hub: workers");
+		return;
+	}
+	for (i=0; i<nWorkers; i++){
+		workers[i].epollFd = epoll_create1(EPOLL_CLOEXEC);
+		workers[i].wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		ev.events = EPOLLIN;
+		ev.data.u32 = POOL_WAKE;
+		if (workers[i].epollFd == -1 || workers[i].wakeFd == -1
+		    || epoll_ctl(workers[i].epollFd, EPOLL_CTL_ADD, workers[i].wakeFd, &ev) == -1){
+			perror("hub: worker setup");
+			return;
+		}
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+	if (queueLimit > 0){
+		drainFd = epoll_create1(EPOLL_CLOEXEC);
+		if (drainFd == -1 || pthread_create(&drainer, NULL, drainRec, NULL) != 0){
+			perror("hub: drainRec");
+			return;
+		}
+	}
+	pthread_mutex_lock(&stnsLock);
+	listening = TRUE;
+	for (i=0 ; i < nStns ; i++)
+		if (fdsTran[i] != -1)
+			startListening(i);
+	pthread_mutex_unlock(&stnsLock);
+	for (i=0; i<nWorkers; i++){
+		if (pthread_create(&workers[i].thread, NULL, runWorker, (void *) (long) i) != 0){
+			perror("hub: pthread_create");
+			nWorkers = i;  // only those are stopped
+			break;
+		}
+		placePoolWorker(workers[i].thread, i);
+	}
+
+	while (!hubFinished())
+		usleep(END_CHECK * 1000);
+	pthread_mutex_lock(&stnsLock);
+	listening = FALSE;
+	pthread_mutex_unlock(&stnsLock);
+	atomic_store(&poolStop, TRUE);
+	for (i=0; i<nWorkers; i++)
+		eventSignal(workers[i].wakeFd);
+	clock_gettime(CLOCK_REALTIME, &limit);
+	limit.tv_sec += POOL_JOIN_SECS;
+	for (i=0; i<nWorkers; i++)
+		if (pthread_timedjoin_np(workers[i].thread, NULL, &limit) != 0)
+			pthread_cancel(workers[i].thread);
+	if (queueLimit > 0)
+		pthread_cancel(drainer);
+}
+
+/*-------------------------------------------------------------------
+Function: runWorker
+Parameters:
+    index - index of the worker (in workers)
+Description:
+   Runs in its own thread (see runWorkerPool()): serves the slots
+   queued in its jobs with serveJob(), and once they are done steals
+   the jobs of the other workers (stealJob()).  With nothing to do,
+   it announces that it is idle and waits on its epoll instance; the
+   slots reported ready are queued in its jobs, and when there are
+   more than one, as many idle workers are woken up to steal them.
+   The idle flag is set before the last look at the other workers,
+   so a job queued meanwhile is either seen or wakes the worker up.
+-------------------------------------------------------------------*/
+void *runWorker(void *index)
+{
+	struct worker *w = &workers[(long) index];
+	struct epoll_event events[POOL_EVENTS];  // pipes reported ready
+	int ready;
+	int stn;
+	int i;
+	int n;
+
+	while (!atomic_load(&poolStop)){
+		stn = takeJob(w);
+		if (stn == -1)
+			stn = stealJob(w);
+		if (stn == -1){
+			atomic_store(&w->idle, TRUE);
+			stn = stealJob(w);
+		}
+		if (stn != -1){
+			atomic_store(&w->idle, FALSE);
+			serveJob(stn);
+			continue;
+		}
+		ready = epoll_wait(w->epollFd, events, POOL_EVENTS, -1);
+		atomic_store(&w->idle, FALSE);
+		pthread_mutex_lock(&w->lock);
+		for (i=0; i<ready; i++)
+			if (events[i].data.u32 == POOL_WAKE)
+				eventWait(w->wakeFd);  // only wakes the worker up
+			else
+				w->jobs[(w->head + w->count++) % MAX_STNS] = events[i].data.u32;
+		n = w->count;
+		pthread_mutex_unlock(&w->lock);
+		for (i=0; i<nWorkers && n > 1; i++)  // the jobs this worker cannot start now
+			if (atomic_exchange(&workers[i].idle, FALSE)){
+				eventSignal(workers[i].wakeFd);
+				n--;
+			}
+	}
+	return(NULL);
+}
+
+/*-------------------------------------------------------------------
+Function: takeJob
+Parameters:
+    w - a worker
+Description:
+   Removes the oldest job of the worker and returns its slot, or -1
+   if it has none.
+-------------------------------------------------------------------*/
+int takeJob(struct worker *w)
+{
+	int stn = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->count > 0){
+		stn = w->jobs[w->head];
+		w->head = (w->head + 1) % MAX_STNS;
+		w->count--;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return(stn);
+}
+
+/*-------------------------------------------------------------------
+Function: stealJob
+Parameters:
+    w - the worker looking for a job
+Description:
+   Removes the newest job of another worker (the owner takes the
+   oldest ones) and returns its slot, or -1 if no worker has one.
+   The workers are visited from the one after w, so that the idle
+   ones do not all look at the same worker first.
+-------------------------------------------------------------------*/
+int stealJob(struct worker *w)
+{
+	struct worker *victim;
+	int stn = -1;
+	int i;
+
+	for (i=1; i<nWorkers && stn == -1; i++){
+		victim = &workers[(w - workers + i) % nWorkers];
+		if (victim->count == 0) continue;  // no lock for a first look
+		pthread_mutex_lock(&victim->lock);
+		if (victim->count > 0)
+			stn = victim->jobs[(victim->head + --victim->count) % MAX_STNS];
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return(stn);
+}
+
+/*-------------------------------------------------------------------
+Function: serveJob
+Parameters:
+    stn - slot whose transmission pipe is ready
+Description:
+   Does one read on the pipe of the station with readTran(), and
+   then registers the pipe again with the epoll instance of its
+   worker, which reports it at once if data is left.  A station
+   whose pipe is closed is released (see releaseStation()).
+-------------------------------------------------------------------*/
+void serveJob(int stn)
+{
+	struct epoll_event ev;
+	char buffer[BUFSIZ];  // buffer for error messages
+	int num;              // value returned by read
+
+	num = readTran(stn);
+	if (num == 0 || (num == -1 && errno != EAGAIN)){
+		/* other end of pipe closed or fatal error - stop listening to this station */
+		if (num == -1){
+			sprintf(buffer,"Fatal error in reading on fd %d (%d)",fdsTran[stn],getpid());
+			perror(buffer);
+		}
+		else
+			fprintf(stderr,"Pipe closed (%d)\n",getpid());
+		releaseStation(stn);
+		return;
+	}
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u32 = stn;
+	epoll_ctl(workers[stn % nWorkers].epollFd, EPOLL_CTL_MOD, fdsTran[stn], &ev);
+}
+
+/*-------------------------------------------------------------------
+Function: runUringLoop
+Description:
+   Same as runEventLoop(), with the reads and writes going through
+   io_uring (see uring.h): a read is always pending on each
+   transmission pipe (postRead()), and each output queue is written
+   with one writev() at a time (postQueue()); all requests prepared
+   during a turn of the loop are submitted with the wait for the next
+   completions in a single system call, so many frames are forwarded
+   per kernel transition.  The frames for a station are always
+   queued (see deliver()), and flushQueues() applies -b and -d as in
+   the epoll mode; while a station does not read, its queue fills up
+   to queueLimit (IOV_MAX without -q) and -o applies.  Stations attached by other threads get their
+   first read from the loop, woken up through uringWakeFd (see
+   startListening()).
+   Returns at the end of the run, once the stations are drained (see
+   hubFinished()) and the last writes have completed (for at most
+   URING_LAST_MSECS; the frames of those left are counted as dropped).
+-------------------------------------------------------------------*/
+void runUringLoop()
+{
+	unsigned long long data;               // value of the request that completed
+	long long wakeup;                      // when uringSubmit() must return (usec)
+	long long due = -1;                    // when the next output queue is due (usec)
+	long long limit;                       // end of the wait for the last writes (usec)
+	int res;                               // result of the request
+	int i;
+
+	uringWakeFd = eventfd(0, EFD_CLOEXEC);
+	if (uringWakeFd == -1){
+		perror("hub: eventfd");
+		return;
+	}
+	placeWorker(pthread_self(), -1);
+	uringRead(&ring, uringWakeFd, &uringWake, sizeof(uringWake), URING_DATA(URING_WAKE, 0));
+	pthread_mutex_lock(&stnsLock);
+	listening = TRUE;
+	for (i=0 ; i < nStns ; i++)
+		if (fdsTran[i] != -1)
+			startListening(i);
+	pthread_mutex_unlock(&stnsLock);
+
+	while (!hubFinished()){
+		if (atomic_exchange(&uringNew, FALSE))
+			armSlots();
+		wakeup = nowUsec() + END_CHECK * 1000LL;
+		if (due != -1 && due < wakeup) wakeup = due;
+		if (uringSubmit(&ring, wakeup > nowUsec() ? wakeup - nowUsec() : 1) == -1 && errno != ETIME && errno != EINTR){
+			perror("hub: io_uring_enter");
+			break;
+		}
+		while (uringCompletion(&ring, &data, &res))
+			uringDone(data, res);
+		due = flushQueues(FALSE);
+	}
+	flushQueues(TRUE);
+	limit = nowUsec() + URING_LAST_MSECS * 1000LL;
+	while (uringWrites > 0 && nowUsec() < limit){
+		uringSubmit(&ring, END_CHECK * 1000LL);
+		while (uringCompletion(&ring, &data, &res))
+			uringDone(data, res);
+	}
+	for (i=0 ; i < nStns ; i++)  // writes that never completed (a station that does not read)
+		for ( ; outQueues[i].inFlight > 0 ; outQueues[i].inFlight--)
+			STAT_ADD(&hubStats[i], framesDropped, outQueues[i].frames[outQueues[i].inFlight-1]);
+	pthread_mutex_lock(&stnsLock);
+	listening = FALSE;
+	pthread_mutex_unlock(&stnsLock);
+	uringClose(&ring);  // cancels the reads and the writes left
+	close(uringWakeFd);
+}
+
+/*-------------------------------------------------------------------
+Function: armSlots
+Description:
+   Posts the first read of the slots marked by startListening(),
+   and writes the queues filled by other threads (see flushQueue()).
+-------------------------------------------------------------------*/
+void armSlots()
+{
+	int i;
+
+	pthread_mutex_lock(&stnsLock);
+	for (i=0 ; i < nStns ; i++)
+		if (uringArm[i]){
+			uringArm[i] = FALSE;
+			if (fdsTran[i] != -1)
+				postRead(i);
+		}
+	pthread_mutex_unlock(&stnsLock);
+	flushQueues(TRUE);
+}
+
+/*-------------------------------------------------------------------
+Function: postRead
+Parameters:
+    stn - slot of the station
+Description:
+   Prepares a read of the transmission pipe of the station into the
+   free space of its reassembly buffer.
+-------------------------------------------------------------------*/
+void postRead(int stn)
+{
+	struct reasmBuf *r = &reasmBufs[stn];
+
+	uringRead(&ring, fdsTran[stn], r->data + r->len, BUFSIZ - r->len, URING_DATA(URING_READ, stn));
+}
+
+/*-------------------------------------------------------------------
+Function: postQueue
+Parameters:
+    stn - slot of the station
+Description:
+   Prepares a writev() of all the runs in the output queue of the
+   station, unless one is already pending: the runs queued meanwhile
+   are written once it completes (see queueDone()), so they keep
+   their order.  Called by the loop, with the lock of the station
+   held (see flushQueue()).
+-------------------------------------------------------------------*/
+void postQueue(int stn)
+{
+	struct outQueue *q = &outQueues[stn];
+
+	if (q->inFlight > 0 || q->count == 0 || fdsRec[stn] == -1) return;
+	uringWritev(&ring, fdsRec[stn], q->iov, q->count, URING_DATA(URING_WRITE, stn));
+	q->inFlight = q->count;
+	uringWrites++;
+	STAT_ADD(&hubStats[stn], writes, 1);
+}
+
+/*-------------------------------------------------------------------
+Function: uringDone
+Parameters:
+    data - value of the request that completed (URING_DATA())
+    res  - its result (-errno on error)
+Description:
+   Handles a completion of the ring: forwards the frames read on a
+   transmission pipe and posts the next read (a station whose pipe
+   is closed is released, see releaseStation()), frees the runs
+   written with queueDone(), or posts the next read of uringWakeFd.
+   The completions of a slot released since the request was posted
+   (its generation changed) are ignored.
+-------------------------------------------------------------------*/
+void uringDone(unsigned long long data, int res)
+{
+	char buffer[BUFSIZ];  // buffer for error messages
+	int kind = (data >> 16) & 0xffff;
+	int stn = data & 0xffff;
+	unsigned gen = data >> 32;
+
+	if (kind == URING_WAKE){
+		uringRead(&ring, uringWakeFd, &uringWake, sizeof(uringWake), URING_DATA(URING_WAKE, 0));
+		return;
+	}
+	if (kind == URING_WRITE){
+		queueDone(stn, gen, res);
+		return;
+	}
+	if (gen != uringGen[stn]) return;
+	STAT_ADD(&hubStats[stn], reads, 1);
+	if (res > 0){
+		forwardRead(stn, res);
+		postRead(stn);
+	}
+	else if (res == -EINTR || res == -EAGAIN){
+		STAT_ADD(&hubStats[stn], eagains, 1);
+		postRead(stn);
+	}
+	else {
+		/* other end of pipe closed or fatal error - stop listening to this station */
+		if (res < 0){
+			errno = -res;
+			sprintf(buffer,"Fatal error in reading on fd %d (%d)",fdsTran[stn],getpid());
+			perror(buffer);
+		}
+		else
+			fprintf(stderr,"Pipe closed (%d)\n",getpid());
+		uringGen[stn]++;
+		releaseStation(stn);
+	}
+}
+
+/*-------------------------------------------------------------------
+Function: queueDone
+Parameters:
+    stn - slot of the station
+    gen - generation of the slot when the writev() was posted
+    res - its result: the bytes written, or -errno
+Description:
+   Frees the runs written by the writev() posted by postQueue() and
+   keeps the rest (what a short write left) at the head of the
+   queue, then posts the writev() of the runs left and of those
+   queued meanwhile.  The runs of a station that has been detached
+   (or released) are dropped, and a station that has closed its
+   pipe is detached (see closeRec()).  The bytes written and the
+   frames of the runs completely written are counted here.
+-------------------------------------------------------------------*/
+void queueDone(int stn, unsigned gen, int res)
+{
+	struct outQueue *q = &outQueues[stn];
+	long long now = nowUsec();
+	int gone = FALSE;  // TRUE when the station has closed its pipe
+	int n;             // runs of the writev()
+	int done;          // runs completely written (or dropped)
+	int i;
+
+	uringWrites--;
+	pthread_mutex_lock(&recLocks[stn]);
+	n = q->inFlight;
+	q->inFlight = 0;
+	if (gen != uringGen[stn])  // released: the counters of the slot are no longer its
+		done = n;
+	else if (res == -EINTR || res == -EAGAIN){
+		STAT_ADD(&hubStats[stn], eagains, 1);
+		done = 0;
+	}
+	else if (res < 0){
+		errno = -res;
+		perror("hub: writev");
+		gone = res == -EPIPE;
+		done = 0;
+	}
+	else {
+		STAT_ADD(&hubStats[stn], bytesOut, res);
+		for (done=0 ; done < n && res >= (int) q->iov[done].iov_len ; done++){
+			res -= q->iov[done].iov_len;
+			STAT_ADD(&hubStats[stn], framesOut, q->frames[done]);
+			statsLatency(now - q->readAt[done]);
+		}
+		if (done < n){  // part of a run was written
+			STAT_ADD(&hubStats[stn], shortWrites, 1);
+			q->iov[done].iov_base = (char *) q->iov[done].iov_base + res;
+			q->iov[done].iov_len -= res;
+		}
+	}
+	if (gen == uringGen[stn] && (fdsRec[stn] == -1 || (res < 0 && res != -EINTR && res != -EAGAIN)))
+		for ( ; done < n ; done++)  // the runs left are dropped
+			STAT_ADD(&hubStats[stn], framesDropped, q->frames[done]);
+	for (i=0; i<done; i++)
+		poolRelease(q->bufs[i]);
+	q->count -= done;
+	memmove(q->bufs, q->bufs + done, q->count * sizeof(struct frameBuf *));
+	memmove(q->iov, q->iov + done, q->count * sizeof(struct iovec));
+	memmove(q->readAt, q->readAt + done, q->count * sizeof(long long));
+	memmove(q->frames, q->frames + done, q->count * sizeof(int));
+	statsQueue(&hubStats[stn], q->count);
+	if (gone)
+		closeRec(stn);
+	else
+		postQueue(stn);
+	pthread_mutex_unlock(&recLocks[stn]);
+}
+
+/*-------------------------------------------------------------------
+Function: runSpliceLoop
+
+Description:
+   Same as runEventLoop() but the data of a ready transmission pipe
+   is flooded with spliceTran(), which never copies it into the hub.
+   Frames are not inspected (so BIN_HELLO frames are not answered
+   and stations keep sending text frames): this relies on each station writing
+   whole frames with a single write() (at most PIPE_BUF bytes, so
+   atomic), so the data available in a transmission pipe always
+   ends on a frame boundary.  The relay pipe used by spliceTran() is
+   made as large as the largest transmission pipe so that all the
+   available data always fits in it (stations attached later get
+   pipes of the default size).
+   Returns at the end of the run (see hubFinished()).
+-------------------------------------------------------------------*/
+void runSpliceLoop()
+{
+	int efd;                                // epoll instance
+	struct epoll_event events[MAX_STNS];    // pipes reported ready
+	int relay[2];                           // pipe holding the data being flooded
+	int relaySize;                          // capacity of the relay pipe
+	char *buffer;                           // to empty the relay pipe when tee() falls short
+	int fdNull;                             // /dev/null, to discard the relay pipe
+	int ready;                              // number of ready pipes
+	int i;
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd == -1 || pipe2(relay, O_CLOEXEC) == -1 || (fdNull = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1){
+		perror("hub: splice setup");
+		return;
+	}
+	relaySize = fcntl(relay[1], F_GETPIPE_SZ);
+	placeWorker(pthread_self(), -1);
+	pthread_mutex_lock(&stnsLock);
+	loopFd = efd;
+	listening = TRUE;
+	for (i=0 ; i < nStns ; i++)
+		if (fdsTran[i] != -1){
+			if (fcntl(fdsTran[i], F_GETPIPE_SZ) > relaySize)
+				relaySize = fcntl(relay[1], F_SETPIPE_SZ, fcntl(fdsTran[i], F_GETPIPE_SZ));
+			startListening(i);
+		}
+	pthread_mutex_unlock(&stnsLock);
+	buffer = malloc(relaySize);
+	if (relaySize == -1 || buffer == NULL){
+		perror("hub: relay pipe");
+		return;
+	}
+
+	while (!hubFinished()){
+		ready = epoll_wait(efd, events, MAX_STNS, END_CHECK);
+		if (ready == -1){
+			if (errno == EINTR) continue;
+			perror("hub: epoll_wait");
+			break;
+		}
+		for (i=0; i<ready; i++)
+			if (events[i].events & EPOLLIN)
+				spliceTran(events[i].data.u32, relay, fdNull, buffer);
+			else {
+				/* other end of pipe closed - stop listening to this station */
+				fprintf(stderr,"Pipe closed (%d)\n",getpid());
+				releaseStation(events[i].data.u32);
+			}
+	}
+	pthread_mutex_lock(&stnsLock);
+	loopFd = -1;
+	listening = FALSE;
+	pthread_mutex_unlock(&stnsLock);
+	free(buffer);
+	close(relay[0]);
+	close(relay[1]);
+	close(fdNull);
+	close(efd);
+}
+
+/*-------------------------------------------------------------------
+Function: spliceTran
+Parameters:
+    src    - index of the station whose transmission pipe is ready
+    relay  - the fds of an empty pipe
+    fdNull - fd open on /dev/null
+    buffer - buffer as large as the relay pipe
+Description:
+   Floods all data available in the transmission pipe of station src
+   into the other reception pipes without copying it into the hub:
+   the data is moved into the relay pipe with splice(), duplicated
+   into each reception pipe with tee(), and then discarded by
+   splicing it into /dev/null.
+   tee() always copies from the start of the relay pipe, so when a
+   reception pipe accepts only part of the data, the relay pipe is
+   read into buffer instead of being discarded and the rest of the
+   data is written to that reception pipe with writeAll().
+   The frames are not counted (hubStats), only the bytes.
+-------------------------------------------------------------------*/
+void spliceTran(int src, int relay[2], int fdNull, char *buffer)
+{
+   ssize_t teed[MAX_STNS];  // bytes duplicated into each reception pipe
+   int avail;               // bytes available in the transmission pipe
+   ssize_t num;             // bytes moved into the relay pipe
+   ssize_t n;
+   int shortTee = FALSE;    // TRUE when a reception pipe accepted only part of the data
+   int calls;               // calls to write() of writeAll()
+   int i;
+
+   if(ioctl(fdsTran[src], FIONREAD, &avail) == -1 || avail == 0) avail = PIPE_BUF;
+   num = splice(fdsTran[src], NULL, relay[1], NULL, avail, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+   STAT_ADD(&hubStats[src], reads, 1);
+   if(num <= 0)
+   {
+      if(num == -1 && errno != EAGAIN) perror("hub: splice");
+      if(num == -1 && errno == EAGAIN) STAT_ADD(&hubStats[src], eagains, 1);
+      return;
+   }
+   STAT_ADD(&hubStats[src], bytesIn, num);
+   reasmBufs[src].readAt = nowUsec();
+   // Following line can be used for debugging
+   //printf("hub: flooding %d bytes from %d\n",(int)num,fdsTran[src]);
+   for(i=0 ; i < nStns ; i++)
+      if(i != src)
+      {
+         teed[i] = num;
+         pthread_mutex_lock(&recLocks[i]);
+         if(fdsRec[i] == -1)
+         {
+            pthread_mutex_unlock(&recLocks[i]);
+            continue;
+         }
+         do n = tee(relay[0], fdsRec[i], num, 0); while(n == -1 && errno == EINTR);
+         pthread_mutex_unlock(&recLocks[i]);
+         teed[i] = n > 0 ? n : 0;
+         if(teed[i] < num) shortTee = TRUE;
+         STAT_ADD(&hubStats[i], writes, 1);
+         STAT_ADD(&hubStats[i], bytesOut, teed[i]);  // the rest once written with writeAll()
+      }
+
+   // empty the relay pipe: discard it, or read it when reception pipes must be completed
+   n = 0;
+   if(!shortTee)
+      while(n < num && (i = splice(relay[0], NULL, fdNull, NULL, num - n, SPLICE_F_MOVE)) > 0)
+         n += i;
+   for( ; n < num ; n += i)
+      if((i = read(relay[0], buffer + n, num - n)) <= 0)
+      {
+         perror("hub: read of relay pipe");
+         return;
+      }
+   for(i=0 ; i < nStns ; i++)
+      if(i != src && teed[i] < num)
+      {
+         pthread_mutex_lock(&recLocks[i]);
+         if(fdsRec[i] != -1)
+         {
+            n = writeAll(fdsRec[i], buffer + teed[i], num - teed[i], &calls);
+            STAT_ADD(&hubStats[i], writes, calls);
+            STAT_ADD(&hubStats[i], shortWrites, calls);
+            STAT_ADD(&hubStats[i], bytesOut, n);
+         }
+         pthread_mutex_unlock(&recLocks[i]);
+      }
+   statsLatency(nowUsec() - reasmBufs[src].readAt);
 }
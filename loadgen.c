@@ -0,0 +1,380 @@
+/*------------------------------------------------------------
+File: loadgen.c
+
+Description: Benchmark driver for the hub.  It writes the
+configuration files of N synthetic stations (see %load in stn.c)
+into a temporary directory, runs the hub with them, and once the
+stations are done reports for all of them together:
+    frames/s  - messages acknowledged per second (Acks not counted)
+    bytes/s   - bytes of the messages acknowledged per second
+    p50/p99/p999 - percentiles of the round-trip time of a message
+                   (until its acknowledgement is received)
+The rates are computed from the first transmission to the last
+acknowledgement, so the time the hub runs idle is not counted.
+
+Traffic patterns (-P):
+    all-to-one - stations B, C, ... send to station A
+    pairs      - A and B send to each other, C and D, ... (with an
+                 odd number of stations, the last one sends to A)
+    broadcast  - each station sends each message to all the others
+                 (BROADCAST_ID, see frame.h) and waits for all their
+                 acknowledgements (%acks in stn.c)
+The options after -- are given to the hub (e.g. -- -m epoll -x shm).
+With -h hubs, the stations are shared between a cascade of hubs
+(hub -H): station i is served by hub i % hubs, and the frames between
+stations of different hubs cross the links.  With -l percent, each
+station drops that percentage of the frames it receives (%loss in
+stn.c), so the messages and acknowledgements lost are sent again.
+With -z n, the last n stations never read what they receive (%stall
+in stn.c) and take no part in the pattern: the others must still get
+all their messages through, however the hub deals with the stalled
+ones (e.g. -- -m uring).
+The hub and stn programs must be in the current directory.
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "frame.h"
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_STNS 26            // Stations are named A to Z
+#define PROGRAM_HUB "./hub"    // The hub
+#define PROGRAM_STN "./stn"    // The station given to the hub
+#define WAIT_STATS 100         // Times to look for the statistics of the stations
+#define WAIT_STATS_USEC 50000  // Time between two looks
+
+// Options
+int stations = 4;              // number of stations (-n)
+int count = 10000;             // messages sent by each station (-c)
+int size = 64;                 // size of the messages (-s)
+double rate = 0;               // messages per second per station (-r, 0: no limit)
+int window = 0;                // window of the stations (-w)
+char *format = "text";         // format of the frames (-F)
+char *pattern = "pairs";       // traffic pattern (-P)
+int runTime = 5;               // seconds the hub runs (-t)
+int hubs = 1;                  // number of hubs sharing the stations (-h)
+double loss = 0;               // percentage of the frames received dropped by the stations (-l)
+int stalled = 0;               // stations that never read, among the last ones (-z)
+
+/* Prototypes */
+int writeConfigs(char *, char *);
+int runHub(char *, int, char **);
+int readStats(char *, char *, int *, int *);
+int compareInts(const void *, const void *);
+
+/*-------------------------------------------------------------
+Function: main
+Parameters:
+    int ac - number of arguments on the command line
+    char **av - array of pointers to the arguments
+Description:
+    Evaluates the options, writes the configurations of the
+    stations with writeConfigs(), runs the hub with runHub(),
+    collects the statistics with readStats() and prints the results
+    on one line.  The temporary directory is removed at the end.
+    Exits with 1 if a station left no statistics, if fewer
+    messages were acknowledged than sent or if the hub did not exit
+    normally, e.g. on a crash (make bench then fails).
+-------------------------------------------------------------*/
+int main(int ac, char **av)
+{
+   char dir[] = "/tmp/loadgenXXXXXX";  // directory of the configurations and statistics
+   char senders[MAX_STNS+1];   // identifiers of the stations that send messages
+   int *rtts;                  // round-trip times of all stations
+   int acked = 0;              // messages acknowledged
+   int found;                  // stations whose statistics were found
+   int hubOk;                  // TRUE if the hub exited normally
+   int opt;
+   int i;
+
+   while((opt = getopt(ac, av, "n:c:s:r:w:F:P:t:h:l:z:")) != -1)
+   {
+      if(opt == 'n' && atoi(optarg) >= 2 && atoi(optarg) <= MAX_STNS) stations = atoi(optarg);
+      else if(opt == 'c' && atoi(optarg) > 0) count = atoi(optarg);
+      else if(opt == 's' && atoi(optarg) > 0) size = atoi(optarg);
+      else if(opt == 'r' && atof(optarg) >= 0) rate = atof(optarg);
+      else if(opt == 'w' && atoi(optarg) >= 0) window = atoi(optarg);
+      else if(opt == 'F') format = optarg;
+      else if(opt == 'P' && (strcmp(optarg, "all-to-one") == 0 || strcmp(optarg, "pairs") == 0
+                             || strcmp(optarg, "broadcast") == 0)) pattern = optarg;
+      else if(opt == 't' && atoi(optarg) > 0) runTime = atoi(optarg);
+      else if(opt == 'h' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_STNS) hubs = atoi(optarg);
+      else if(opt == 'l' && atof(optarg) >= 0 && atof(optarg) < 100) loss = atof(optarg);
+      else if(opt == 'z' && atoi(optarg) >= 0) stalled = atoi(optarg);
+      else
+      {
+         fprintf(stderr,"Usage: loadgen [-n stations] [-c count] [-s size] [-r rate] [-w window] [-F text|binary]\n"
+                        "               [-P all-to-one|pairs|broadcast] [-t secs] [-h hubs] [-l loss%%] [-z stalled]\n"
+                        "               [-- hub options]\n");
+         exit(-1);
+      }
+   }
+   if(stations - stalled < 2)
+   {
+      fprintf(stderr,"loadgen: at least 2 of the %d stations must not be stalled (-z)\n",stations);
+      exit(-1);
+   }
+   if(mkdtemp(dir) == NULL)
+   {
+      perror("loadgen: mkdtemp");
+      exit(-1);
+   }
+   if(writeConfigs(dir, senders) == FALSE)
+      exit(-1);
+   hubOk = runHub(dir, ac - optind, av + optind);
+
+   rtts = malloc((long) strlen(senders) * count * sizeof(int));
+   if(rtts == NULL)
+   {
+      perror("loadgen");
+      exit(-1);
+   }
+   printf("loadgen: %s", pattern);
+   if(hubs > 1)
+      printf(" (%d hubs)", hubs);
+   for(i=optind; i<ac; i++)
+      printf(" %s", av[i]);
+   printf(": ");
+   found = readStats(dir, senders, rtts, &acked);
+   if(acked > 0)
+      qsort(rtts, acked, sizeof(int), compareInts);
+   else
+      rtts[0] = 0;
+   printf(", rtt p50 %d us, p99 %d us, p999 %d us\n",
+          rtts[acked/2], rtts[(int) (acked*0.99)], rtts[(int) (acked*0.999)]);
+
+   for(i=0; i<stations; i++)  // remove the temporary files
+   {
+      char name[BUFSIZ];
+      snprintf(name, BUFSIZ, "%s/stn%c.cfg", dir, 'A'+i);
+      unlink(name);
+      snprintf(name, BUFSIZ, "%s/%c.rtt", dir, 'A'+i);
+      unlink(name);
+   }
+   rmdir(dir);
+   if(!hubOk)
+   {
+      fprintf(stderr,"loadgen: the hub did not exit normally\n");
+      return(1);
+   }
+   if(found < (int) strlen(senders) || acked < (int) strlen(senders) * count)
+   {
+      fprintf(stderr,"loadgen: %d of %d stations reported, %d of %d messages acknowledged\n",
+              found, (int) strlen(senders), acked, (int) strlen(senders) * count);
+      return(1);
+   }
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: writeConfigs
+Parameters:
+    dir     - directory receiving the configuration files
+    senders - to return the identifiers of the stations that send
+Description:
+    Writes the configuration file dir/stnX.cfg of each station
+    according to the traffic pattern: the destinations of its
+    messages (%load) and the file receiving its round-trip times
+    (%stats dir/X.rtt), with broadcast the stations that
+    acknowledge them (%acks), and with -l the frames lost
+    (%loss).  A station of all-to-one that only receives gets no
+    %load, and a stalled one (-z) only %stall.  Returns FALSE if a
+    file cannot be written.
+-------------------------------------------------------------*/
+int writeConfigs(char *dir, char *senders)
+{
+   char name[BUFSIZ];          // name of a configuration file
+   char dests[MAX_STNS+1];     // destinations of a station
+   char acks[MAX_STNS+1];      // stations acknowledging its messages (broadcast)
+   FILE *fp;
+   int active = stations - stalled;  // stations taking part in the pattern
+   int i, j;
+
+   *senders = '\0';
+   for(i=0; i<stations; i++)
+   {
+      *dests = '\0';
+      *acks = '\0';
+      if(i >= active)
+         ;  // stalled
+      else if(strcmp(pattern, "all-to-one") == 0 && i > 0)
+         strcpy(dests, "A");
+      else if(strcmp(pattern, "pairs") == 0)
+         sprintf(dests, "%c", (i^1) < active ? 'A'+(i^1) : 'A');
+      else if(strcmp(pattern, "broadcast") == 0)
+      {
+         sprintf(dests, "%c", BROADCAST_ID);
+         for(j=0; j<active; j++)
+            if(j != i) sprintf(acks+strlen(acks), "%c", 'A'+j);
+      }
+
+      snprintf(name, BUFSIZ, "%s/stn%c.cfg", dir, 'A'+i);
+      fp = fopen(name, "w");
+      if(fp == NULL)
+      {
+         perror(name);
+         return(FALSE);
+      }
+      fprintf(fp, "# Station generated by loadgen (%s)\n%c\n%c\n", pattern, 'A'+i, *dests ? *dests : 'A');
+      fprintf(fp, "%%window %d\n%%format %s\n", window, format);
+      if(loss > 0)
+         fprintf(fp, "%%loss %g\n", loss);
+      if(i >= active)
+         fprintf(fp, "%%stall\n");
+      if(*dests)
+      {
+         fprintf(fp, "%%load %d %d %g %s\n%%stats %s/%c.rtt\n", count, size, rate, dests, dir, 'A'+i);
+         if(*acks)
+            fprintf(fp, "%%acks %s\n", acks);
+         sprintf(senders+strlen(senders), "%c", 'A'+i);
+      }
+      fclose(fp);
+   }
+   return(TRUE);
+}
+
+/*-------------------------------------------------------------
+Function: runHub
+Parameters:
+    dir     - directory of the configuration files
+    nOpts   - number of options for the hub
+    hubOpts - options for the hub
+Description:
+    Runs the hub with the options, until no frame has arrived for
+    a second (at most runTime seconds, see hub -I), without
+    delay between the creation of the stations, and with the
+    configuration files of dir.  With several hubs, the first one
+    creates the others (-H, with the same options) and each one
+    gets its share of the configuration files.
+    Returns when the hub terminates: TRUE if it exited with
+    status 0, FALSE otherwise (killed by a signal, or an error).
+-------------------------------------------------------------*/
+int runHub(char *dir, int nOpts, char **hubOpts)
+{
+   char *args[nOpts + stations + 2*hubs + 10];
+   char names[MAX_STNS][BUFSIZ];  // names of the configuration files
+   char subHubs[MAX_STNS][BUFSIZ];  // options of the other hubs (-H)
+   char runArg[16];
+   int n = 0;
+   int i, k;
+   int pid;
+   int status;
+
+   args[n++] = "hub";
+   args[n++] = "-s";
+   args[n++] = "0";
+   args[n++] = "-t";
+   sprintf(runArg, "%d", runTime);
+   args[n++] = runArg;
+   args[n++] = "-I";
+   args[n++] = "1";
+   args[n++] = "-p";
+   args[n++] = PROGRAM_STN;
+   for(i=0; i<nOpts; i++)
+      args[n++] = hubOpts[i];
+   for(k=1; k<hubs; k++)
+   {
+      args[n++] = "-H";
+      snprintf(subHubs[k], BUFSIZ, "-s 0 -t %d -I 1 -p %s", runTime, PROGRAM_STN);
+      for(i=0; i<nOpts; i++)
+         snprintf(subHubs[k]+strlen(subHubs[k]), BUFSIZ-strlen(subHubs[k]), " %s", hubOpts[i]);
+      for(i=k; i<stations; i+=hubs)
+         snprintf(subHubs[k]+strlen(subHubs[k]), BUFSIZ-strlen(subHubs[k]), " %s/stn%c.cfg", dir, 'A'+i);
+      args[n++] = subHubs[k];
+   }
+   for(i=0; i<stations; i+=hubs)
+   {
+      snprintf(names[i], BUFSIZ, "%s/stn%c.cfg", dir, 'A'+i);
+      args[n++] = names[i];
+   }
+   args[n] = NULL;
+
+   pid = fork();
+   if(pid < 0)
+   {
+      perror("loadgen: fork");
+      exit(-1);
+   }
+   else if(pid == 0)
+   {
+      execv(PROGRAM_HUB, args);
+      perror("loadgen: " PROGRAM_HUB);
+      exit(-1);
+   }
+   if(waitpid(pid, &status, 0) == -1)
+   {
+      perror("loadgen: waitpid");
+      return(FALSE);
+   }
+   return(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/*-------------------------------------------------------------
+Function: readStats
+Parameters:
+    dir      - directory of the statistics files
+    senders  - identifiers of the stations that send
+    rtts     - to return the round-trip times of all stations
+    ackedPtr - to return the number of round-trip times
+Description:
+    Reads the statistics file written by each station that sends
+    (see loadReport() in stn.c), waiting for the stations to write
+    them after the hub is gone, and prints the totals and rates
+    (without ending the line).
+    Returns the number of stations whose statistics were found.
+-------------------------------------------------------------*/
+int readStats(char *dir, char *senders, int *rtts, int *ackedPtr)
+{
+   char name[BUFSIZ];
+   FILE *fp;
+   char id;
+   int acked;
+   long long bytes, first, last;
+   long long totalBytes = 0;
+   long long minFirst = 0, maxLast = 0;
+   int found = 0;
+   int tries;
+   int i, k;
+   double secs;
+
+   *ackedPtr = 0;
+   for(i=0; senders[i] != '\0'; i++)
+   {
+      snprintf(name, BUFSIZ, "%s/%c.rtt", dir, senders[i]);
+      for(tries=0; (fp = fopen(name, "r")) == NULL && tries < WAIT_STATS; tries++)
+         usleep(WAIT_STATS_USEC);
+      if(fp == NULL)
+      {
+         fprintf(stderr,"loadgen: no statistics from station %c\n", senders[i]);
+         continue;
+      }
+      if(fscanf(fp, " %c %d %lld %lld %lld", &id, &acked, &bytes, &first, &last) == 5)
+      {
+         for(k=0; k<acked && fscanf(fp, "%d", &rtts[*ackedPtr]) == 1; k++)
+            (*ackedPtr)++;
+         totalBytes += bytes;
+         if(acked > 0 && (minFirst == 0 || first < minFirst)) minFirst = first;  // 0: not set yet
+         if(acked > 0 && last > maxLast) maxLast = last;
+         found++;
+      }
+      fclose(fp);
+   }
+   secs = (maxLast - minFirst) / 1000000.0;
+   printf("%d stations (%d sending), %d/%d messages of %d bytes in %.3f s, %.0f frames/s, %.0f bytes/s",
+          stations, (int) strlen(senders), *ackedPtr, (int) strlen(senders) * count, size, secs,
+          secs > 0 ? *ackedPtr / secs : 0.0, secs > 0 ? totalBytes / secs : 0.0);
+   return(found);
+}
+
+/*-------------------------------------------------------------
+Function: compareInts
+Description:
+    Compares two ints for qsort().
+-------------------------------------------------------------*/
+int compareInts(const void *a, const void *b)
+{
+   return(*(const int *) a - *(const int *) b);
+}
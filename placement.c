@@ -0,0 +1,249 @@
+/*------------------------------------------------------------
+File: placement.c
+
+Description: Placement of the hub threads and of the stations on
+the processors (see placement.h).  The NUMA node of a processor is
+read from /sys (the directory of processor n holds a link nodeN),
+so no library is needed; without it, all are taken as node 0.
+-------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include "placement.h"
+
+#define TRUE 1
+#define FALSE 0
+
+static int policy = PLACE_NONE;  // placement policy
+static int priority = 0;         // SCHED_FIFO priority of the forwarding threads (0: none)
+static int workers = 0;          // workers of the pool mode (0: not in the pool mode)
+static int cpus[CPU_SETSIZE];    // processors the hub may run on, by NUMA node
+static int nCpus = 0;            // number of processors in cpus
+static int nodes[CPU_SETSIZE];   // NUMA node of each processor (read once, see placeInit())
+static int fifoRefused = FALSE;  // TRUE once SCHED_FIFO has been refused (reported once)
+
+static int cpuNode(int);
+static int compareCpus(const void *, const void *);
+static int stationCpu(int);
+static int hubCpus();
+static void pinThread(pthread_t, int);
+
+/*-------------------------------------------------------------
+Function: placeInit
+Parameters:
+    how  - placement policy (PLACE_...)
+    prio - SCHED_FIFO priority of the forwarding threads (0: none)
+    pool - number of workers of the pool mode (0: another mode)
+Description:
+   Lists the processors of the affinity mask of the hub, ordered by
+   NUMA node and number.  Returns 0, or -1 if the priority is out of
+   range or the mask cannot be read (a message is printed).
+-------------------------------------------------------------*/
+int placeInit(int how, int prio, int pool)
+{
+   cpu_set_t set;
+   int i;
+
+   policy = how;
+   priority = prio;
+   workers = pool;
+   if(priority != 0 && (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)))
+   {
+      fprintf(stderr,"hub: SCHED_FIFO priorities go from %d to %d\n",
+              sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+      return(-1);
+   }
+   if(sched_getaffinity(0, sizeof(set), &set) == -1)
+   {
+      perror("hub: sched_getaffinity");
+      return(-1);
+   }
+   for(i=0; i<CPU_SETSIZE; i++)
+      if(CPU_ISSET(i, &set))
+      {
+         nodes[i] = cpuNode(i);
+         cpus[nCpus++] = i;
+      }
+   qsort(cpus, nCpus, sizeof(int), compareCpus);
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: cpuNode
+Parameters:
+    cpu - processor number
+Description:
+   Returns the NUMA node of the processor (0 if unknown).
+-------------------------------------------------------------*/
+static int cpuNode(int cpu)
+{
+   char path[64];
+   DIR *dir;
+   struct dirent *entry;
+   int node = 0;
+
+   snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+   dir = opendir(path);
+   if(dir == NULL) return(0);
+   while((entry = readdir(dir)) != NULL)
+      if(sscanf(entry->d_name, "node%d", &node) == 1)
+         break;
+   closedir(dir);
+   return(node);
+}
+
+/*-------------------------------------------------------------
+Function: compareCpus
+Parameters:
+    a, b - processor numbers
+Description:
+   Orders the processors by NUMA node (nodes), then by number
+   (qsort()).
+-------------------------------------------------------------*/
+static int compareCpus(const void *a, const void *b)
+{
+   int na = nodes[*(int *) a];
+   int nb = nodes[*(int *) b];
+
+   if(na != nb) return(na - nb);
+   return(*(int *) a - *(int *) b);
+}
+
+/*-------------------------------------------------------------
+Function: stationCpu
+Parameters:
+    slot - slot of the station
+Description:
+   Returns the processor of the station in the slot.  With
+   PLACE_DEDICATED, the first hubCpus() processors are left to the
+   hub unless there are no others.  With PLACE_COLOCATE in the pool
+   mode, the stations served by a worker (slot modulo the number of
+   workers, see startListening() in hub.c) share its processor.
+-------------------------------------------------------------*/
+static int stationCpu(int slot)
+{
+   int n = hubCpus();
+
+   if(policy == PLACE_DEDICATED && nCpus > n)
+      return(cpus[n + slot % (nCpus-n)]);
+   if(policy == PLACE_COLOCATE && workers > 0)
+      return(cpus[slot % workers % nCpus]);
+   return(cpus[slot % nCpus]);
+}
+
+/*-------------------------------------------------------------
+Function: hubCpus
+Description:
+   Returns the number of processors kept for the forwarding
+   threads with PLACE_DEDICATED: one per worker in the pool mode,
+   one otherwise, always leaving one to the stations if possible.
+-------------------------------------------------------------*/
+static int hubCpus()
+{
+   int n = workers > 0 ? workers : 1;
+
+   if(n > nCpus-1) n = nCpus > 1 ? nCpus-1 : 1;
+   return(n);
+}
+
+/*-------------------------------------------------------------
+Function: placeStation
+Parameters:
+    slot - slot of the station
+Description:
+   Pins the calling process, a station forked by the hub, to its
+   processor; the affinity is kept by execlp().  Without a policy,
+   does nothing.  The station does not keep the SCHED_FIFO policy
+   of the thread that forked it.
+-------------------------------------------------------------*/
+void placeStation(int slot)
+{
+   cpu_set_t set;
+   struct sched_param param = {0};
+
+   if(priority != 0)  // forked by a thread running under SCHED_FIFO
+      sched_setscheduler(0, SCHED_OTHER, &param);
+   if(policy == PLACE_NONE || nCpus == 0) return;
+   CPU_ZERO(&set);
+   CPU_SET(stationCpu(slot), &set);
+   if(sched_setaffinity(0, sizeof(set), &set) == -1)
+      perror("stn: sched_setaffinity");
+}
+
+/*-------------------------------------------------------------
+Function: placeWorker
+Parameters:
+    thread - a thread forwarding frames of the hub
+    slot   - slot of the station it serves (-1: it serves them all,
+             as the loop of the epoll, splice and uring modes)
+Description:
+   Pins the thread according to the policy (on the first processor
+   with PLACE_DEDICATED, on the processor of its station with
+   PLACE_COLOCATE) and sets its SCHED_FIFO priority.
+-------------------------------------------------------------*/
+void placeWorker(pthread_t thread, int slot)
+{
+   int cpu = -1;
+
+   if(policy == PLACE_DEDICATED && nCpus > 0)
+      cpu = cpus[0];
+   else if(policy == PLACE_COLOCATE && slot >= 0 && nCpus > 0)
+      cpu = stationCpu(slot);
+   pinThread(thread, cpu);
+}
+
+/*-------------------------------------------------------------
+Function: placePoolWorker
+Parameters:
+    thread - a worker of the pool mode
+    worker - its index
+Description:
+   Pins the worker according to the policy: with PLACE_DEDICATED
+   on its own processor among those kept for the hub (hubCpus()),
+   with PLACE_COLOCATE on the processor of the stations it serves
+   (see stationCpu()); sets its SCHED_FIFO priority.
+-------------------------------------------------------------*/
+void placePoolWorker(pthread_t thread, int worker)
+{
+   int cpu = -1;
+
+   if(policy == PLACE_DEDICATED && nCpus > 0)
+      cpu = cpus[worker % hubCpus()];
+   else if(policy == PLACE_COLOCATE && nCpus > 0)
+      cpu = cpus[worker % nCpus];
+   pinThread(thread, cpu);
+}
+
+/*-------------------------------------------------------------
+Function: pinThread
+Parameters:
+    thread - a thread forwarding frames of the hub
+    cpu    - processor it is pinned to (-1: none)
+Description:
+   Pins the thread to the processor and sets its SCHED_FIFO
+   priority.
+-------------------------------------------------------------*/
+static void pinThread(pthread_t thread, int cpu)
+{
+   cpu_set_t set;
+   struct sched_param param;
+   int err;
+
+   CPU_ZERO(&set);
+   if(cpu >= 0)
+   {
+      CPU_SET(cpu, &set);
+      if((err = pthread_setaffinity_np(thread, sizeof(set), &set)) != 0)
+         fprintf(stderr,"hub: pthread_setaffinity_np: %s\n",strerror(err));
+   }
+   if(priority == 0 || fifoRefused) return;
+   param.sched_priority = priority;
+   if((err = pthread_setschedparam(thread, SCHED_FIFO, &param)) != 0)
+   {
+      fprintf(stderr,"hub: SCHED_FIFO refused (%s), running with the default policy\n",strerror(err));
+      fifoRefused = TRUE;
+   }
+}
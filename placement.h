@@ -0,0 +1,37 @@
+/*------------------------------------------------------------
+File: placement.h
+
+Description: Placement of the hub and of its stations on the
+processors (hub -A and -P).  The processors the hub may run on are
+ordered by NUMA node, so that stations placed one after the other
+fill a node before using the next one; the station in slot i gets
+processor i (modulo their number) of this list.  The policies:
+    PLACE_NONE      - the scheduler places everything
+    PLACE_SPREAD    - each station is pinned to its processor
+    PLACE_DEDICATED - the forwarding threads of the hub are pinned
+                      to the first processor (each worker of the
+                      pool mode to its own, from the first ones),
+                      and the stations are spread over the others
+    PLACE_COLOCATE  - each station and the thread forwarding its
+                      frames (threads mode) share its processor; in
+                      the pool mode, worker i gets processor i and
+                      the stations it serves share it
+With a priority, the forwarding threads also run under SCHED_FIFO
+(this needs CAP_SYS_NICE; the hub goes on without it otherwise).
+-------------------------------------------------------------*/
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <pthread.h>
+
+#define PLACE_NONE 0
+#define PLACE_SPREAD 1
+#define PLACE_DEDICATED 2
+#define PLACE_COLOCATE 3
+
+int placeInit(int, int, int);
+void placeStation(int);
+void placeWorker(pthread_t, int);
+void placePoolWorker(pthread_t, int);
+
+#endif
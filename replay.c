@@ -0,0 +1,285 @@
+/*------------------------------------------------------------
+File: replay.c
+
+Description: Feeds a capture file of the hub (hub -c, see
+capture.h) back into a hub, to reproduce the traffic captured or
+to benchmark the hub against it.  The tool connects to the socket
+of a hub accepting other hubs (hub -L path), so it is served as a
+hub below it: the frames of the capture are forwarded to the
+stations of the hub as if their sources were behind the link.
+The frames the hub sends back (acknowledgements, floods) are read
+and dropped.
+
+The runs of frames are sent at the times they were captured, or
+one after the other as fast as the hub takes them with -f; -v
+prints each run with the slots that received it in the capture.
+The tool then closes its side of the link and waits for the hub to
+close the other, and prints a summary.
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "capture.h"
+#include "frame.h"
+
+#define TRUE 1
+#define FALSE 0
+
+// Options
+int fast = FALSE;              // TRUE to send the runs without waiting (-f)
+int verbose = FALSE;           // TRUE to print each run (-v)
+
+long long dropped = 0;         // bytes sent by the hub and dropped
+
+/* Prototypes */
+int connectHub(char *);
+void printRun(struct capRecord *, long long);
+void waitUntil(int, long long);
+int sendAll(int, char *, int);
+int drainHub(int);
+long long nowUsec();
+
+/*-------------------------------------------------------------
+Function: main
+Parameters:
+    int ac - number of arguments on the command line
+    char **av - array of pointers to the arguments
+Description:
+    Maps the capture file, connects to the hub with connectHub()
+    and sends it each run of frames of the capture, waiting for its
+    time with waitUntil() unless -f is given, and printing it with
+    printRun() if -v is given.
+-------------------------------------------------------------*/
+int main(int ac, char **av)
+{
+   struct stat st;
+   struct capHeader *hdr;
+   struct capRecord *rec;
+   char *map;
+   char *pt;
+   long long first = 0;        // time of the first run in the capture
+   long long start;            // time at which the first run is sent
+   long long last = 0;         // time of the last run in the capture
+   int runs = 0;
+   long long frames = 0;
+   long long bytes = 0;
+   int fdCap;
+   int fd;
+   int opt;
+
+   while((opt = getopt(ac, av, "fv")) != -1)
+   {
+      if(opt == 'f') fast = TRUE;
+      else if(opt == 'v') verbose = TRUE;
+      else
+      {
+         fprintf(stderr,"Usage: replay [-f] [-v] <capture> <hub socket>\n");
+         exit(-1);
+      }
+   }
+   if(ac - optind != 2)
+   {
+      fprintf(stderr,"Usage: replay [-f] [-v] <capture> <hub socket>\n");
+      exit(-1);
+   }
+   fdCap = open(av[optind], O_RDONLY);
+   if(fdCap == -1 || fstat(fdCap, &st) == -1)
+   {
+      perror(av[optind]);
+      exit(-1);
+   }
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fdCap, 0);
+   hdr = (struct capHeader *) map;
+   if(map == MAP_FAILED || st.st_size < (off_t) sizeof(struct capHeader) || strcmp(hdr->magic, CAP_MAGIC) != 0)
+   {
+      fprintf(stderr,"replay: %s is not a capture file\n",av[optind]);
+      exit(-1);
+   }
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+   signal(SIGPIPE, SIG_IGN);  // the hub closing the connection is seen by sendAll()
+   fd = connectHub(av[optind+1]);
+   if(fd == -1)
+      exit(-1);
+
+   start = nowUsec();
+   for(pt = map + sizeof(struct capHeader); pt + sizeof(struct capRecord) <= map + st.st_size; pt += CAP_RECORD_LEN(rec->len))
+   {
+      rec = (struct capRecord *) pt;
+      if(rec->usec == 0 || rec->len < 0 || pt + sizeof(struct capRecord) + rec->len > map + st.st_size)
+         break;  // end of the records
+      if(runs == 0) first = rec->usec;
+      last = rec->usec;
+      if(!fast)
+         waitUntil(fd, start + rec->usec - first);
+      if(verbose)
+         printRun(rec, rec->usec - first);
+      if(sendAll(fd, (char *) (rec+1), rec->len) == -1)
+      {
+         perror("replay: hub");
+         break;
+      }
+      runs++;
+      frames += rec->frames;
+      bytes += rec->len;
+   }
+   // the hub sees the end of the link and closes it once it has forwarded everything
+   shutdown(fd, SHUT_WR);
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+   drainHub(fd);
+   printf("replay: %d runs, %lld frames, %lld bytes in %.3f s (captured in %.3f s), %lld bytes dropped\n",
+          runs, frames, bytes, (nowUsec() - start) / 1000000.0, (last - first) / 1000000.0, dropped);
+   close(fd);
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: connectHub
+Parameters:
+    path - socket of the hub (hub -L)
+Description:
+    Connects to the hub and makes the connection non-blocking, so
+    that the frames of the hub can be dropped while waiting to send
+    (see sendAll()).  Returns the fd, or -1 on error.
+-------------------------------------------------------------*/
+int connectHub(char *path)
+{
+   struct sockaddr_un addr;
+   int fd;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+   {
+      perror(path);
+      if(fd != -1) close(fd);
+      return(-1);
+   }
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   return(fd);
+}
+
+/*-------------------------------------------------------------
+Function: printRun
+Parameters:
+    rec  - record of a run of frames
+    usec - time of the run since the first one of the capture
+Description:
+    Prints the run: its time, its frames, its source, its target
+    (a slot, all other slots or a group) and the slots that
+    received it when it was captured.
+-------------------------------------------------------------*/
+void printRun(struct capRecord *rec, long long usec)
+{
+   int i;
+
+   printf("replay: %.6f s: %d frames (%d bytes) from slot %d to ", usec / 1000000.0, rec->frames, rec->len, rec->src);
+   if(rec->target >= 0)
+      printf("slot %d", rec->target);
+   else if(rec->target == -1)
+      printf("all");
+   else
+      printf("group %c", GROUP_FIRST - 2 - rec->target);
+   printf(", received by %d slots:", rec->receivers);
+   for(i=0; i<CAP_SLOTS; i++)
+      if(CAP_RECEIVED(rec, i))
+         printf(" %d", i);
+   printf("\n");
+}
+
+/*-------------------------------------------------------------
+Function: waitUntil
+Parameters:
+    fd  - connection to the hub
+    due - time (usec) to wait for
+Description:
+    Waits until due, dropping what the hub sends meanwhile (once
+    the hub has closed the connection, only waits).
+-------------------------------------------------------------*/
+void waitUntil(int fd, long long due)
+{
+   struct pollfd pfd;
+   long long now;
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   while((now = nowUsec()) < due)
+      if(poll(&pfd, 1, (due - now + 999) / 1000) > 0 && !drainHub(fd))
+         pfd.fd = -1;  // poll() ignores it
+}
+
+/*-------------------------------------------------------------
+Function: sendAll
+Parameters:
+    fd   - connection to the hub
+    data - frames to send
+    len  - number of bytes in data
+Description:
+    Sends all the bytes to the hub; while it has no space for them,
+    waits and drops what it sends (the hub may itself be waiting for
+    space in the other direction).  Returns 0, or -1 on error.
+-------------------------------------------------------------*/
+int sendAll(int fd, char *data, int len)
+{
+   struct pollfd pfd;
+   int n;
+
+   pfd.fd = fd;
+   pfd.events = POLLIN | POLLOUT;
+   while(len > 0)
+   {
+      n = write(fd, data, len);
+      if(n > 0)
+      {
+         data += n;
+         len -= n;
+      }
+      else if(n == -1 && errno != EAGAIN)
+         return(-1);
+      else if(poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN) && !drainHub(fd))
+         return(-1);  // the hub closed the connection
+   }
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: drainHub
+Parameters:
+    fd - connection to the hub
+Description:
+    Reads and drops what the hub has sent.  Returns FALSE if the
+    hub has closed the connection.
+-------------------------------------------------------------*/
+int drainHub(int fd)
+{
+   char buf[BUFSIZ];
+   int n;
+
+   while((n = read(fd, buf, BUFSIZ)) > 0)
+      dropped += n;
+   return(n != 0);
+}
+
+/*-------------------------------------------------------------
+Function: nowUsec
+Description:
+   Returns the current time in microseconds (CLOCK_MONOTONIC).
+-------------------------------------------------------------*/
+long long nowUsec()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+}
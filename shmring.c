@@ -0,0 +1,284 @@
+/*------------------------------------------------------------
+File: shmring.c
+
+Description: Shared memory rings used by the hub and the station
+processes with the shm transport (see shmring.h).
+
+The head and tail counters run freely and are masked with
+RING_SIZE-1 to index data; head-tail is the number of bytes in
+the ring.  A process that waits sets its wakeup flag, then checks
+the ring again; the side that moves a counter stores it, then
+reads the flag.  Both pairs are ordered by sequentially consistent
+operations (a fence after setting the flag, as ringRead() and
+ringWrite() load the other counter with acquire only), so that a
+consumer that sets its flag and finds the ring empty can never miss
+the signal of a producer that fills it, and conversely.
+-------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include "shmring.h"
+
+/*-------------------------------------------------------------
+Function: shmLinkCreate
+Parameters:
+    memfdPt - to return the fd of the memfd holding the link
+Description:
+   Creates and maps a link with two empty rings whose consumers
+   are waiting for data (so the first write signals them).  The
+   memfd is inherited across fork/exec so the station can map the
+   link with shmLinkMap().  Returns NULL on error.
+-------------------------------------------------------------*/
+struct shmLink *shmLinkCreate(int *memfdPt)
+{
+   struct shmLink *lk;
+   int memfd;
+
+   memfd = memfd_create("hub-link", 0);
+   if(memfd == -1) return(NULL);
+   if(ftruncate(memfd, sizeof(struct shmLink)) == -1)
+   {
+      close(memfd);
+      return(NULL);
+   }
+   *memfdPt = memfd;
+   lk = shmLinkMap(memfd);
+   if(lk != NULL)
+   {
+      atomic_store(&lk->up.dataWaiting, 1);
+      atomic_store(&lk->down.dataWaiting, 1);
+   }
+   return(lk);
+}
+
+/*-------------------------------------------------------------
+Function: shmLinkMap
+Parameters:
+    memfd - fd of the memfd holding the link
+Description:
+   Maps the link held by memfd.  Returns NULL on error.
+-------------------------------------------------------------*/
+struct shmLink *shmLinkMap(int memfd)
+{
+   void *pt;
+
+   pt = mmap(NULL, sizeof(struct shmLink), PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+   return(pt == MAP_FAILED ? NULL : pt);
+}
+
+/*-------------------------------------------------------------
+Function: ringRead
+Parameters:
+    r       - ring to read from (called by its consumer only)
+    buf     - buffer to receive the bytes
+    len     - size of buf
+    fdSpace - eventfd of the producer waiting for space
+Description:
+   Copies up to len bytes from the ring into buf and returns the
+   number of bytes copied (0 if the ring is empty).  Wakes up the
+   producer if it is waiting for space.
+-------------------------------------------------------------*/
+int ringRead(struct shmRing *r, char *buf, int len, int fdSpace)
+{
+   unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+   unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+   unsigned pos = tail & (RING_SIZE-1);
+   unsigned num = head - tail;
+   unsigned first;
+
+   if(num > (unsigned) len) num = len;
+   if(num == 0) return(0);
+   first = RING_SIZE - pos < num ? RING_SIZE - pos : num;  // bytes before the end of data
+   memcpy(buf, r->data + pos, first);
+   memcpy(buf + first, r->data, num - first);
+   atomic_store(&r->tail, tail + num);
+   if(atomic_load(&r->spaceWaiting) && atomic_exchange(&r->spaceWaiting, 0))
+      eventSignal(fdSpace);
+   return(num);
+}
+
+/*-------------------------------------------------------------
+Function: ringReadWait
+Parameters:
+    r       - ring to read from (called by its consumer only)
+    buf     - buffer to receive the bytes
+    len     - size of buf
+    fdSpace - eventfd of the producer waiting for space
+    fdWait  - eventfd on which this process is woken up
+Description:
+   As ringRead() but waits on fdWait while the ring is empty.
+   Returns 0 once the ring is empty and closed, or -1 if waiting
+   failed (errno is EAGAIN if fdWait is non-blocking).
+-------------------------------------------------------------*/
+int ringReadWait(struct shmRing *r, char *buf, int len, int fdSpace, int fdWait)
+{
+   int num;
+
+   while(1)
+   {
+      if((num = ringRead(r, buf, len, fdSpace)) > 0) return(num);
+      atomic_store(&r->dataWaiting, 1);
+      atomic_thread_fence(memory_order_seq_cst);  // the flag is set before the check
+      // check again: the producer may have written before seeing the flag
+      if((num = ringRead(r, buf, len, fdSpace)) > 0) return(num);
+      if(atomic_load(&r->closed)) return(0);
+      if(eventWait(fdWait) == -1) return(-1);
+   }
+}
+
+/*-------------------------------------------------------------
+Function: ringWaitData
+Parameters:
+    r       - ring to wait on (called by its consumer only)
+    fdWait  - eventfd on which this process is woken up
+    timeout - maximum wait in msec (restarted by a spurious wakeup)
+Description:
+   Waits as ringReadWait() does until the ring holds data or is
+   closed, without reading it.  Returns 1 then, 0 if timeout
+   expires first, or -1 on error.
+-------------------------------------------------------------*/
+int ringWaitData(struct shmRing *r, int fdWait, int timeout)
+{
+   struct pollfd pfd;
+
+   pfd.fd = fdWait;
+   pfd.events = POLLIN;
+   while(1)
+   {
+      if(atomic_load(&r->head) != atomic_load(&r->tail) || atomic_load(&r->closed)) return(1);
+      atomic_store(&r->dataWaiting, 1);
+      atomic_thread_fence(memory_order_seq_cst);  // the flag is set before the check
+      // check again: the producer may have written before seeing the flag
+      if(atomic_load(&r->head) != atomic_load(&r->tail) || atomic_load(&r->closed)) return(1);
+      switch(poll(&pfd, 1, timeout))
+      {
+         case 0: return(0);
+         case -1: if(errno != EINTR) return(-1); break;
+         default: if(eventWait(fdWait) == -1) return(-1);
+      }
+   }
+}
+
+/*-------------------------------------------------------------
+Function: ringWrite
+Parameters:
+    r      - ring to write to (called by its producer only)
+    buf    - bytes to write
+    len    - number of bytes to write
+    fdData - eventfd of the consumer waiting for data
+Description:
+   Copies as many of the len bytes as fit into the ring and returns
+   the number of bytes copied (0 if the ring is full).  Wakes up
+   the consumer if it is waiting for data.
+-------------------------------------------------------------*/
+int ringWrite(struct shmRing *r, char *buf, int len, int fdData)
+{
+   unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+   unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+   unsigned pos = head & (RING_SIZE-1);
+   unsigned num = RING_SIZE - (head - tail);
+   unsigned first;
+
+   if(num > (unsigned) len) num = len;
+   if(num == 0) return(0);
+   first = RING_SIZE - pos < num ? RING_SIZE - pos : num;
+   memcpy(r->data + pos, buf, first);
+   memcpy(r->data, buf + first, num - first);
+   atomic_store(&r->head, head + num);
+   if(atomic_load(&r->dataWaiting) && atomic_exchange(&r->dataWaiting, 0))
+      eventSignal(fdData);
+   return(num);
+}
+
+/*-------------------------------------------------------------
+Function: ringWriteAll
+Parameters:
+    r      - ring to write to (called by its producer only)
+    buf    - bytes to write
+    len    - number of bytes to write
+    fdData - eventfd of the consumer waiting for data
+    fdWait - eventfd on which this process is woken up
+Description:
+   As ringWrite() but waits on fdWait while the ring is full,
+   until all len bytes are written.  Returns len, or -1 if waiting
+   failed or the ring was closed while full.
+-------------------------------------------------------------*/
+int ringWriteAll(struct shmRing *r, char *buf, int len, int fdData, int fdWait)
+{
+   int done = 0;
+   int num;
+
+   while(done < len)
+   {
+      if((num = ringWrite(r, buf + done, len - done, fdData)) > 0)
+      {
+         done += num;
+         continue;
+      }
+      atomic_store(&r->spaceWaiting, 1);
+      atomic_thread_fence(memory_order_seq_cst);  // the flag is set before the check
+      // check again: the consumer may have read before seeing the flag
+      if((num = ringWrite(r, buf + done, len - done, fdData)) > 0)
+      {
+         done += num;
+         continue;
+      }
+      if(atomic_load(&r->closed)) return(-1);
+      if(eventWait(fdWait) == -1) return(-1);
+   }
+   return(len);
+}
+
+/*-------------------------------------------------------------
+Function: ringClose
+Parameters:
+    r      - ring to close (called by its producer only)
+    fdData - eventfd of the consumer
+Description:
+   Marks the ring closed (the consumer reads 0 once it is empty,
+   as for a pipe whose write end is closed) and wakes up the
+   consumer.
+-------------------------------------------------------------*/
+void ringClose(struct shmRing *r, int fdData)
+{
+   atomic_store(&r->closed, 1);
+   eventSignal(fdData);
+}
+
+/*-------------------------------------------------------------
+Function: eventSignal
+Parameters:
+    fd - eventfd to signal
+Description:
+   Adds 1 to the counter of the eventfd, waking up its reader.
+-------------------------------------------------------------*/
+void eventSignal(int fd)
+{
+   uint64_t one = 1;
+
+   while(write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+      ;
+}
+
+/*-------------------------------------------------------------
+Function: eventWait
+Parameters:
+    fd - eventfd to wait on
+Description:
+   Waits until the eventfd is signaled and resets its counter.
+   Returns 0, or -1 on error (EAGAIN if fd is non-blocking and
+   was not signaled).
+-------------------------------------------------------------*/
+int eventWait(int fd)
+{
+   uint64_t count;
+
+   while(read(fd, &count, sizeof(count)) == -1)
+      if(errno != EINTR) return(-1);
+   return(0);
+}
@@ -0,0 +1,55 @@
+/*------------------------------------------------------------
+File: shmring.h
+
+Description: Shared memory transport between the hub and a
+station process (hub -x shm).  Each station shares one link with
+the hub: a memfd mapped in both processes holding two single
+producer/single consumer byte rings, one per direction.  The
+rings carry the same byte stream as the pipes would.
+
+A process only makes a system call to wake up the other side:
+the consumer of a ring sets dataWaiting before it sleeps on its
+eventfd, and the producer signals that eventfd only if the flag
+is set (i.e. the ring went from empty to non-empty while the
+consumer was waiting).  spaceWaiting does the same for a
+producer waiting for space in a full ring.
+-------------------------------------------------------------*/
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdatomic.h>
+
+#define RING_SIZE 65536   // bytes in each ring (a power of 2)
+#define CACHE_LINE 64
+
+struct shmRing
+{
+   atomic_uint head;         // bytes written so far (by the producer only)
+   char pad1[CACHE_LINE - sizeof(atomic_uint)];
+   atomic_uint tail;         // bytes read so far (by the consumer only)
+   char pad2[CACHE_LINE - sizeof(atomic_uint)];
+   atomic_int dataWaiting;   // TRUE while the consumer waits for data
+   atomic_int spaceWaiting;  // TRUE while the producer waits for space
+   atomic_int closed;        // TRUE once the producer has closed the ring
+   char pad3[CACHE_LINE - 3*sizeof(atomic_int)];
+   char data[RING_SIZE];
+};
+
+struct shmLink
+{
+   struct shmRing up;        // station to hub (transmission)
+   struct shmRing down;      // hub to station (reception)
+};
+
+struct shmLink *shmLinkCreate(int *);
+struct shmLink *shmLinkMap(int);
+int ringRead(struct shmRing *, char *, int, int);
+int ringReadWait(struct shmRing *, char *, int, int, int);
+int ringWaitData(struct shmRing *, int, int);
+int ringWrite(struct shmRing *, char *, int, int);
+int ringWriteAll(struct shmRing *, char *, int, int, int);
+void ringClose(struct shmRing *, int);
+void eventSignal(int);
+int eventWait(int);
+
+#endif
@@ -0,0 +1,93 @@
+/*------------------------------------------------------------
+File: stats.c
+
+Description: Hot-path counters of the hub (see stats.h).
+
+The latency histogram counts, for each run of frames, the time
+from the read that completed it to its write to a station (after
+waiting in an output queue when batching).  Its buckets are powers
+of two, so recording a sample is one count-leading-zeros and one
+atomic addition.
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include "stats.h"
+
+static atomic_ullong latencyHist[LAT_BUCKETS];  // see statsLatency()
+
+/*-------------------------------------------------------------
+Function: statsLatency
+Parameters:
+    usecs - time spent in the hub by a run of frames
+Description:
+   Counts the sample in the bucket of the latency histogram
+   holding it: bucket i for usecs below 2^i (and >= 2^(i-1)).
+-------------------------------------------------------------*/
+void statsLatency(long long usecs)
+{
+   int i = usecs <= 0 ? 0 : 64 - __builtin_clzll(usecs);
+
+   if(i >= LAT_BUCKETS) i = LAT_BUCKETS-1;
+   atomic_fetch_add_explicit(&latencyHist[i], 1, memory_order_relaxed);
+}
+
+/*-------------------------------------------------------------
+Function: statsQueue
+Parameters:
+    st    - counters of a station
+    depth - runs now waiting in its output queue
+Description:
+   Records the depth of the output queue and its maximum.  Only
+   called by the thread that owns the queue.
+-------------------------------------------------------------*/
+void statsQueue(struct stnStats *st, int depth)
+{
+   atomic_store_explicit(&st->queueDepth, depth, memory_order_relaxed);
+   if(depth > atomic_load_explicit(&st->maxQueueDepth, memory_order_relaxed))
+      atomic_store_explicit(&st->maxQueueDepth, depth, memory_order_relaxed);
+}
+
+/*-------------------------------------------------------------
+Function: statsDump
+Parameters:
+    fd    - file descriptor to print to
+    stats - counters of the stations
+    fds   - transmission fd of each station (for the labels)
+    n     - number of stations (the slots whose fd is -1 are free)
+Description:
+   Prints a line of counters per station, then the latency
+   histogram (non-empty buckets) with its approximate median,
+   99th and 99.9th percentiles (upper bound of their bucket).
+   The counters are read while they change, so a line is not an
+   exact snapshot.
+-------------------------------------------------------------*/
+void statsDump(int fd, struct stnStats *stats, int *fds, int n)
+{
+   unsigned long long hist[LAT_BUCKETS];
+   unsigned long long total = 0;
+   unsigned long long seen;
+   double marks[] = {0.5, 0.99, 0.999};
+   int i, m;
+
+   dprintf(fd, "hub stats: stn fd framesIn bytesIn framesOut bytesOut reads writes short eagain drops dropped queue maxQueue\n");
+   for(i=0; i<n; i++)
+      if(fds[i] != -1)  // skip the free slots
+         dprintf(fd, "hub stats: %d %d %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %d %d\n", i, fds[i],
+              atomic_load(&stats[i].framesIn), atomic_load(&stats[i].bytesIn),
+              atomic_load(&stats[i].framesOut), atomic_load(&stats[i].bytesOut),
+              atomic_load(&stats[i].reads), atomic_load(&stats[i].writes),
+              atomic_load(&stats[i].shortWrites), atomic_load(&stats[i].eagains), atomic_load(&stats[i].drops),
+              atomic_load(&stats[i].framesDropped),
+              atomic_load(&stats[i].queueDepth), atomic_load(&stats[i].maxQueueDepth));
+   for(i=0; i<LAT_BUCKETS; i++)
+      total += hist[i] = atomic_load(&latencyHist[i]);
+   dprintf(fd, "hub stats: latency (usec)");
+   for(i=0; i<LAT_BUCKETS; i++)
+      if(hist[i] > 0) dprintf(fd, " <%llu:%llu", 1ULL << i, hist[i]);
+   for(m=0; m<3 && total > 0; m++)
+   {
+      for(i=0, seen=hist[0]; seen < marks[m]*total && i < LAT_BUCKETS-1; )
+         seen += hist[++i];
+      dprintf(fd, m == 0 ? " p50<%llu" : m == 1 ? " p99<%llu" : " p999<%llu", 1ULL << i);
+   }
+   dprintf(fd, "\n");
+}
@@ -0,0 +1,41 @@
+/*------------------------------------------------------------
+File: stats.h
+
+Description: Counters kept by the hub on its hot path, per
+station, and a histogram of the time frames spend in the hub.
+They are updated with relaxed atomic additions (no locks), so
+that they can stay on: each station's counters are on their own
+cache lines and are mostly updated by the thread serving it.
+statsDump() prints them (hub -i and -S).
+-------------------------------------------------------------*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#define STATS_LINE 64       // counters of two stations never share a cache line
+#define LAT_BUCKETS 32      // bucket i counts latencies below 2^i usec (and >= 2^(i-1))
+
+struct stnStats
+{
+   atomic_ullong framesIn;     // frames received from the station
+   atomic_ullong bytesIn;      // bytes received from the station
+   atomic_ullong framesOut;    // frames written to the station (once their run is completely written)
+   atomic_ullong bytesOut;     // bytes written to the station
+   atomic_ullong reads;        // reads on the transmission pipe (or ring)
+   atomic_ullong writes;       // writes on the reception pipe (or ring)
+   atomic_ullong shortWrites;  // writes that did not write everything
+   atomic_ullong eagains;      // reads that found no data (EAGAIN), writes that found the pipe or ring full
+   atomic_ullong drops;        // runs of frames dropped from the full output queue (hub -o)
+   atomic_ullong framesDropped;  // frames dropped: by -o, or for the station detached before they were written
+   atomic_int queueDepth;      // runs waiting in the output queue
+   atomic_int maxQueueDepth;   // largest queueDepth seen
+} __attribute__((aligned(STATS_LINE)));
+
+#define STAT_ADD(st, field, n) atomic_fetch_add_explicit(&(st)->field, (n), memory_order_relaxed)
+
+void statsLatency(long long);
+void statsQueue(struct stnStats *, int);
+void statsDump(int, struct stnStats *, int *, int);
+
+#endif
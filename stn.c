@@ -13,23 +13,92 @@ acknowledgement (Ack message).  All communication is done using
 the standard input and standard output.  The station process can still
 print to the screen using the standard error. When the station process
 receives a messages, it reponds by returning an acknowledgement.
+
+With a window of n (option -w n, or a line "%window n" in the
+configuration file), messages are numbered and up to n messages are
+sent before waiting for acknowledgements, which are cumulative.  The
+receiver only accepts messages in sequence and acknowledges the next
+one it expects, so a lost or reordered message is detected by the
+sender as repeated acknowledgements and sent again (go-back-n).
+Without a window, messages are numbered too (a window of 1: stop and
+wait), unless %load sends them to several destinations in turn.
+
+A message not acknowledged in time is sent again, so that a lost or
+garbled frame (message or acknowledgement) does not stop the station:
+the retransmission timeout is estimated from the round-trip times
+measured (see rtoSample()), and doubles at each expiry until something
+new is acknowledged.  The receiver recognizes a message it already accepted by
+its sequence number, drops it and acknowledges it again.  The messages
+sent before the first acknowledgement carry the session of the
+station (see frame.h): a receiver that sees a new session from a
+source expects its numbers from 0 again.  The counts
+of messages sent again and of duplicates are printed at the end.
+"%loss p" drops p percent of the frames received, to test this.
+
+With -F binary (or a line "%format binary" in the configuration file),
+the station asks the hub to use binary frames (see frame.h) and sends
+them once the hub has accepted; until then, and if the hub refuses,
+text frames are sent.  Both kinds of frames are always received.
+
+With the option -s memfd:wake:data:space (given by the hub with its
+shm transport), the standard input and output are replaced by the
+rings of a shared memory link (see shmring.h).
+
+A line "%load count size [rate [dests]]" makes the station a load
+generator: instead of the messages of the file, it sends count
+messages of size bytes, at most rate per second (0: as fast as the
+acknowledgements allow), to the destinations dests in turn (the
+configured destination by default), without printing each message.
+The round-trip time of each message (until its acknowledgement) is
+measured; a summary is printed at the end, and "%stats file" also
+writes the times to a file (see loadReport()).
+
+The destination can also be BROADCAST_ID (all other stations) or a
+group (see frame.h): each message is then sent once and the hub
+delivers it to every member.  A line "%acks ids" gives the stations
+whose acknowledgements each message waits for (the destination by
+default); a message is acknowledged once all of them have (see
+ackerOf()).  A line "%join g" makes the station join group g; frames
+for BROADCAST_ID and for the groups are always received (the hub
+only sends those of a group to its members).
+
+A line "%source path" replaces the messages of the file (at most
+MSGS_MAX, in a buffer of BUFSIZ bytes) by the lines of a file or a
+FIFO, read one at a time when they are first sent (see sourceNext()),
+so that a station can send any number of messages, each up to
+SOURCE_MAX bytes, with constant memory.  "%quiet" stops printing
+each message sent and received.  "%stall" makes a station that sends
+nothing and never reads what it receives, until the hub closes its
+pipe (or ring), to test how the hub copes with it (see stallHub()).
 -------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "frame.h"
+#include "shmring.h"
 
 // Some definitions
 #define MSGS_MAX 10 // Maximum number of messages
 #define TRUE 1
 #define FALSE 0
-
-// for messages
-#define ACKNOWLEDGEMENT "Ack"  // acknowledgement message
-#define STX '@'       // Start of the frame - start of Xmission
-#define ETX '~'       // End of the frame - end of Xmission
-#define STX_POS 0     // Position of STX
-#define DEST_POS 1    // Position of the destination identifier
-#define SRC_POS 2     // Position of the source identifier
-#define MSG_POS 4     // Position of the message
+#define NO_SEQ -1   // Sequence number of a frame without one
+#define DUP_ACKS 3  // Number of repeated acknowledgements that triggers a retransmission
+#define FRAME_BATCH 64  // Number of frames found per call to scanFrames()
+#define RX_SIZE 65536  // Size of the circular buffer of received frames (a power of 2, > BUFSIZ)
+#define SOURCE_MAX (BUFSIZ-SYN_MSG_POS-2)  // Longest message of %source (the frame fits in BUFSIZ)
+#define SOURCE_DROP (1 << 20)  // Bytes of a mapped %source released from memory at a time
+#define RTO_INIT 100  // Retransmission timeout before the first round-trip time is measured (msec)
+#define RTO_MIN 2     // Bounds of the retransmission timeout (msec); RTO_MAX stays below
+#define RTO_MAX 500   // the idle time after which the hub may end a run (hub -I)
 
 // Return values
 #define FINISH 1
@@ -37,11 +106,111 @@ receives a messages, it reponds by returning an acknowledgement.
 #define MSG_EMPTY 3
 #define MSG_RECV 4
 
+// Shared memory link to the hub (option -s), NULL when using the standard input/output
+struct shmLink *hubLink = NULL;
+int fdWake;    // eventfd on which the hub wakes up this station
+int fdData;    // eventfd signaled when data is written to the hub
+int fdSpace;   // eventfd signaled when space is freed for the hub
+
+// Options (set in the configuration file or on the command line)
+int window = 0;  // number of messages sent without acknowledgement (0: no sequence numbers)
+int wantBinary = FALSE;  // TRUE to ask the hub for binary frames
+int binary = 0;          // version of the binary frames sent (0: text frames)
+int verbose = TRUE;      // FALSE not to print each message sent and received (%load)
+char ackers[256] = "";   // stations that acknowledge each message (%acks, empty: the destination)
+char joins[256] = "";    // groups joined (%join)
+double lossRate = 0;     // percentage of the frames received that are dropped (%loss)
+int stall = FALSE;       // TRUE to never read what is received (%stall)
+
+// Load generation (%load and %stats)
+int loadCount = 0;       // number of messages to generate (0: send the messages of the file)
+int loadSize = 0;        // size of the messages generated
+double loadRate = 0;     // messages sent per second (0: no limit)
+char loadDests[256] = "";  // destinations used in turn (empty: the configured destination)
+char loadStats[BUFSIZ] = "";  // file receiving the round-trip times (empty: none)
+char *loadMsg = NULL;    // the message generated
+long long *sentAt;       // time (usec) at which each message was first sent
+int *rtts;               // round-trip time (usec) of each message acknowledged
+int loadAcked = 0;       // number of messages acknowledged
+long long loadFirst;     // time of the first transmission
+long long loadLast;      // time of the last acknowledgement
+
+// Streaming source (%source): the messages are read when they are first sent and kept until
+// they are acknowledged, in a ring of window+1 buffers (sent again with go-back-n).  A regular
+// file is mapped and the pages already read are released; a FIFO is read into srcBuf.
+char srcPath[BUFSIZ] = "";  // file of the messages (empty: the messages of the configuration file)
+int srcFd = -1;          // the file
+char *srcMap = NULL;     // its mapping (NULL: read with read())
+size_t srcSize;          // size of the mapping
+size_t srcPos = 0;       // position of the next line in the mapping
+size_t srcReleased = 0;  // bytes of the mapping released from memory
+char srcBuf[BUFSIZ];     // bytes read but not yet consumed (without mapping)
+int srcLen = 0;          // number of bytes in srcBuf
+int srcEof = FALSE;      // TRUE once the end of the file is reached
+int srcSkip = FALSE;     // TRUE to drop the rest of a line longer than srcBuf
+char *srcRing = NULL;    // messages not yet acknowledged (srcSlots of SOURCE_MAX+1 bytes)
+int srcSlots;            // number of buffers in srcRing
+int srcRead = 0;         // number of messages read so far
+
+// Retransmissions (see rtoSent()): one timer for the oldest message not acknowledged, and one
+// message at a time timed to measure the round-trip time (never one sent again: Karn).
+long long srtt = 0;      // smoothed round-trip time (usec, 0: not measured yet)
+long long rttvar = 0;    // its mean deviation (usec)
+int rtoEstimate = RTO_INIT;  // retransmission timeout given by the round-trip times (msec)
+int rto = RTO_INIT;      // retransmission timeout, doubled at each expiry (msec)
+long long rtoDue = 0;    // when the messages not acknowledged are sent again (usec, 0: none)
+int top = 0;             // next message never sent
+int recover = 0;         // top when the messages were last sent again (see communication())
+int timed = -1;          // message whose round-trip time is measured (-1: none)
+long long timedAt;       // time at which it was sent
+int retransmits = 0;     // messages sent again
+int timeouts = 0;        // expiries of the timer
+int duplicates = 0;      // messages received again (and dropped)
+int outOfSeq = 0;        // messages received ahead of the one expected (and dropped)
+int framesLost = 0;      // frames dropped by %loss
+int session;             // session of this station (see frame.h)
+
+// Circular buffer of the frames received: rd and wr count the bytes removed and received
+// so far, and are masked with RX_SIZE-1 to index data.
+struct rxBuffer
+{
+   char data[RX_SIZE];
+   unsigned rd;   // read cursor
+   unsigned wr;   // write cursor
+};
+
 // Prototypes
 void readFile(FILE *, char *, char *, char *[], char *);
+void readOption(char *);
 void communication(char, char, char *[]);
-int readMessage(char *, char *, char );
-int extractMessage(char *, char *, char *, char );
+char *messageAt(char *[], int);
+void sourceOpen();
+int sourceNext(char *);
+char destAt(char, int);
+int ackerOf(char, char);
+int lowestBase(int *, int);
+int sendDelay(int, long long);
+void loadInit();
+void loadSent(int, long long);
+void loadAck(int, int, long long);
+void loadReport(char);
+void rtoSent(int, long long);
+void rtoAcked(int, int, long long);
+void rtoExpired();
+void rtoSample(long long);
+int dropFrame();
+long long nowUsec();
+void hubExited(int);
+void sendFrame(char, char, int, int, char *);
+int readMessage(char *, char *, int *, int *, char, int);
+int extractMessage(char *, struct rxBuffer *, char *, int *, int *, char );
+char *rxView(struct rxBuffer *, char *, char **);
+char *frameMessage(char *, int, int *, int *);
+int hexField(char *);
+int readHub(char *, int);
+int waitHub(int);
+void stallHub();
+void writeHub(char *, int);
 
 /*-------------------------------------------------------------
 Function: main
@@ -53,7 +222,11 @@ Description:
    file.  The function readFile() configures the station/destination 
    identifiers and reads in the messages.  If no error is found in the
    configuration file, communication() is called to exchange messages
-   with the other station processes.
+   with the other station processes (stallHub() with %stall).
+   With -s, the shared memory link is mapped first, and closed once
+   communication() returns; the SIGTERM sent by the system when the
+   hub exits closes it too (see hubExited()).  -w overrides the window given in the
+   configuration file, and -F the format.
 -------------------------------------------------------------*/
 int main(int ac, char **av)
 {
@@ -62,28 +235,58 @@ int main(int ac, char **av)
    char *messages[MSGS_MAX+1];  // array of pointers to messages - terminated with NULL
    char msgsBuffer[BUFSIZ];     // buffer of messages
    FILE *fp;
+   int memfd;                   // memfd of the shared memory link
+   int cmdWindow = -1;          // window given on the command line
+   int cmdBinary = -1;          // format given on the command line
+   int opt;
 
-   if(ac != 2)
+   frameScanInit();
+   while((opt = getopt(ac, av, "s:w:F:")) != -1)
    {
-       fprintf(stderr,"Usage: stn <fileName>\n");
+      if(opt == 's' && sscanf(optarg,"%d:%d:%d:%d",&memfd,&fdWake,&fdData,&fdSpace) == 4
+         && (hubLink = shmLinkMap(memfd)) != NULL)
+      {
+         close(memfd);
+         signal(SIGTERM, hubExited);
+      }
+      else if(opt == 'w' && atoi(optarg) >= 0 && atoi(optarg) < SEQ_MOD/2)
+         cmdWindow = atoi(optarg);
+      else if(opt == 'F' && strcmp(optarg, "text") == 0)
+         cmdBinary = FALSE;
+      else if(opt == 'F' && strcmp(optarg, "binary") == 0)
+         cmdBinary = TRUE;
+      else
+      {
+         fprintf(stderr,"Usage: stn [-s memfd:wake:data:space] [-w window] [-F text|binary] <fileName>\n");
+         exit(-1);
+      }
+   }
+   if(ac - optind != 1)
+   {
+       fprintf(stderr,"Usage: stn [-s memfd:wake:data:space] [-w window] [-F text|binary] <fileName>\n");
    }
    else
    {
-      fp = fopen(av[1],"r");
+      fp = fopen(av[optind],"r");
       if(fp == NULL) 
       {
-        sprintf(msgsBuffer,"stn (%s)",av[1]);
+        sprintf(msgsBuffer,"stn (%s)",av[optind]);
         perror(msgsBuffer);
       }
       else
       {
          readFile(fp, &idStn, &dest, messages, msgsBuffer);
 	 fclose(fp);
-	 if(idStn != '\0' && dest != '\0') 
+	 if(cmdWindow != -1) window = cmdWindow;
+	 if(cmdBinary != -1) wantBinary = cmdBinary;
+	 if(idStn != '\0' && dest != '\0' && stall)
+	   stallHub();
+	 else if(idStn != '\0' && dest != '\0') 
 	   communication(idStn, dest, messages);
 	 else fprintf(stderr,"File corrupted\n");
       }
    }
+   if(hubLink != NULL) ringClose(&hubLink->up, fdData);
 }
 /*-------------------------------------------------------------
 Function: readFile
@@ -95,8 +298,10 @@ Parameters:
 	msgsBuf  - pointer to buffer to store messages
 Description:
    Read all lines in the file. All empty lines and those starting with # are ignored.
+   Lines starting with % are options (see readOption()).
    First line: use the first character as the station id
    Second line: use the first character as the destination id
+                (a station, BROADCAST_ID or a group)
    Other lines: are the messages.
    (care must be taken with inserting spaces in the file).
 -------------------------------------------------------------*/
@@ -114,7 +319,9 @@ void readFile(FILE *fp, char *idStnPt, char *destPt, char *msgs[], char *msgsBuf
     {
        if(*line != '\n' && *line != '#' && *line != '\0')  // to ignore lines
        {
-           if(*idStnPt == '\0') // found first line
+           if(*line == '%') // found an option
+	       readOption(line);
+           else if(*idStnPt == '\0') // found first line
 	       *idStnPt = *line;  // get first character in the line
 	   else if(*destPt == '\0') // found second line
 	       *destPt = *line;  // get first character in the line
@@ -133,6 +340,63 @@ void readFile(FILE *fp, char *idStnPt, char *destPt, char *msgs[], char *msgsBuf
     }
 }
 
+/*-------------------------------------------------------------
+Function: readOption
+Parameters: 
+	line - line of the configuration file starting with %
+Description:
+   Sets the option given by the line:
+      %window n - number of messages sent without acknowledgement
+      %format text|binary - format of the frames sent
+      %load count size [rate [dests]] - messages generated (see the
+          description at the top of the file)
+      %stats file - file receiving the round-trip times
+      %acks ids - stations acknowledging each message
+      %join g - group joined (can be repeated)
+      %source path - file or FIFO of the messages (see sourceNext())
+      %quiet - messages sent and received are not printed
+      %loss p - percentage of the frames received that are dropped
+   Unknown options are reported and ignored.
+-------------------------------------------------------------*/
+void readOption(char *line)
+{
+    int n;
+    int size;
+    double rate = 0;
+    char word[BUFSIZ];
+
+    *word = '\0';
+    if(sscanf(line, "%%window %d", &n) == 1 && n >= 0 && n < SEQ_MOD/2)
+        window = n;
+    else if(sscanf(line, "%%format %s", word) == 1 && (strcmp(word, "text") == 0 || strcmp(word, "binary") == 0))
+        wantBinary = strcmp(word, "binary") == 0;
+    else if(sscanf(line, "%%load %d %d %lf %255s", &n, &size, &rate, word) >= 2
+            && n > 0 && size > 0 && size < BIN_MAX_LEN - 16 && rate >= 0)
+    {
+        loadCount = n;
+        loadSize = size;
+        loadRate = rate;
+        strcpy(loadDests, word);
+        verbose = FALSE;
+    }
+    else if(sscanf(line, "%%stats %s", word) == 1)
+        strcpy(loadStats, word);
+    else if(sscanf(line, "%%source %s", word) == 1)
+        strcpy(srcPath, word);
+    else if(strncmp(line, "%quiet", 6) == 0)
+        verbose = FALSE;
+    else if(strncmp(line, "%stall", 6) == 0)
+        stall = TRUE;
+    else if(sscanf(line, "%%loss %lf", &rate) == 1 && rate >= 0 && rate < 100)
+        lossRate = rate;
+    else if(sscanf(line, "%%acks %255s", word) == 1)
+        strcpy(ackers, word);
+    else if(sscanf(line, "%%join %c", word) == 1 && IS_GROUP(*word) && strlen(joins) < 255)
+        strncat(joins, word, 1);
+    else
+        fprintf(stderr,"stn: unknown option ignored: %s",line);
+}
+
 /*-------------------------------------------------------------
 Function: communication
 Parameters: 
@@ -152,6 +416,37 @@ Description:
    readMessage().
    Note that readMessage() blocks when the pipe attached to 
    the standard input is empty.
+
+   With a window, message i is sent with sequence number i and up
+   to window messages (base to next-1) wait for an acknowledgement;
+   without one, limit is 1 unless the messages go to several
+   destinations.  An acknowledgement for n acknowledges all messages
+   before n.  If DUP_ACKS acknowledgements in a row do not
+   acknowledge anything new, or if nothing is acknowledged before
+   rtoDue (see rtoSent()), the messages from base are sent again.
+   Acknowledgements repeated for the messages sent before that
+   (up to recover) do not send them once more.
+   Received messages are only accepted in sequence (expected[] holds
+   the next sequence number expected from each source, counted from
+   0 again when the source starts a new session, sessions[]); those
+   behind it are duplicates.  The messages are sent with session
+   until base moves.  Every sequenced message is acknowledged with
+   the next sequence number expected.  Without sequence numbers, the
+   last message is sent again when rtoDue passes.
+
+   With several stations acknowledging each message (%acks), each
+   one has its own base (ackBase[], indexed as ackers) and base is
+   the lowest; without a window, ackFlag only becomes TRUE once all
+   of them have acknowledged the message (ackedBy[]).
+
+   To use binary frames, a BIN_HELLO frame is first sent to the hub;
+   its answer is handled by extractMessage().  The groups of %join
+   are then joined with join frames (see frame.h).
+
+   The messages are given by messageAt() and destAt(), which also
+   cover the generated messages of %load.  A message whose time has
+   not come yet (sendDelay()), and the retransmission timer, bound
+   the wait of readMessage().
 -------------------------------------------------------------*/
 void communication(char idStn, char dest, char *messages[])
 {
@@ -159,42 +454,650 @@ void communication(char idStn, char dest, char *messages[])
    int ackFlag = TRUE;     // acknowledgement flag
    int flag;               // return flag from readMessage()
    char source;            // source identificateur for received message/Ack
+   int seq;                // sequence number of received message/Ack (or NO_SEQ)
    char msg[BUFSIZ];       // buffer for received message
+   int base = 0;           // oldest message not acknowledged (with a window)
+   int dupAcks = 0;        // acknowledgements in a row that did not acknowledge anything
+   int acked;              // number of messages acknowledged by an acknowledgement
+   int nAckers = *ackers != '\0' ? strlen(ackers) : 1;  // stations acknowledging each message
+   int ackBase[256] = {0}; // next message each of them must acknowledge (with a window)
+   char ackedBy[256];      // TRUE for those that acknowledged the last message (without a window)
+   int waiting = 0;        // number of them that did not (without a window)
+   int k;                  // index of the station that sent an acknowledgement (see ackerOf())
+   int low;                // lowest of ackBase[]
+   char join[MSG_POS+2];   // join frame
+   int expected[256] = {0};  // next sequence number expected from each source
+   int sessions[256] = {0};  // last session of each source (0: none seen)
+   int syn;                // session of a received message (0: none)
+   char hello[BIN_HDR_LEN];  // to ask the hub for binary frames
+   char *text;             // message to send
+   long long now;          // current time (usec)
+   int timeout;            // maximum wait for a frame (msec, -1: no limit)
+   int limit;              // messages sent without acknowledgement (0: no sequence numbers)
+   int diff;               // distance of a sequence number received from the one expected
 
+   if(loadCount > 0) loadInit();
+   else if(*srcPath != '\0') sourceOpen();
+   limit = window > 0 ? window : strlen(loadDests) <= 1;
+   session = (getpid() + nowUsec()) % (SEQ_MOD-1) + 1;
+   if(lossRate > 0) srandom(getpid());
+   if(wantBinary)
+   {
+      memset(hello, 0, BIN_HDR_LEN);
+      hello[0] = BIN_MAGIC;
+      hello[DEST_POS] = idStn;
+      hello[SRC_POS] = idStn;
+      hello[BIN_VERSION_POS] = BIN_VERSION;
+      hello[BIN_TYPE_POS] = BIN_HELLO;
+      writeHub(hello, BIN_HDR_LEN);
+   }
+   for(k=0; joins[k] != '\0'; k++)
+   {
+      snprintf(join, sizeof(join), "%c%c%c%c%c", STX, joins[k], idStn, JOIN_SEP, ETX);
+      writeHub(join, MSG_POS+1);
+   }
    // loop for transmission and reception
    while(1) 
    {
       // Transmission of messages 
-      if(ackFlag && (messages[i] != NULL))
+      now = nowUsec();
+      if(rtoDue != 0 && now >= rtoDue)  // nothing acknowledged in time
+      {
+         if(verbose) fprintf(stderr,"Station %c (%d): no acknowledgement in %d ms - sending again from message %d\n",
+                             idStn, getpid(), rto, limit > 0 ? base : i-1);
+         rtoExpired();
+         dupAcks = 0;
+         recover = top;
+         if(limit > 0) i = base;
+         else  // the message is sent again to all its destinations
+         {
+            i--;
+            ackFlag = TRUE;
+         }
+      }
+      timeout = 0;
+      if(limit > 0)
+         while((text = messageAt(messages, i)) != NULL && i - base < limit
+               && (timeout = sendDelay(i, now)) == 0)
+         {
+            if(verbose) fprintf(stderr,"Station %c (%d): Sent to station %c >%s< (%d)\n",idStn,getpid(),destAt(dest,i),text,i);
+            sendFrame(destAt(dest,i),idStn,i % SEQ_MOD,base == 0 ? session : 0,text);
+            loadSent(i, now);
+            rtoSent(i, now);
+            i++;
+         }
+      else if(ackFlag && (text = messageAt(messages, i)) != NULL
+              && (timeout = sendDelay(i, now)) == 0)
       {  // Send message
-         fprintf(stderr,"Station %c (%d): Sent to station %c >%s<\n",idStn,getpid(),dest,messages[i]);
-         sprintf(msg,"%c%c%c-%s%c",STX,dest,idStn,messages[i],ETX);
-         write(1,msg,strlen(msg));   // writes to the standard output, i.e. pipe
+         if(verbose) fprintf(stderr,"Station %c (%d): Sent to station %c >%s<\n",idStn,getpid(),destAt(dest,i),text);
+         sendFrame(destAt(dest,i),idStn,NO_SEQ,0,text);
+         loadSent(i, now);
+         rtoSent(i, now);
          ackFlag = FALSE;            // becomes TRUE at the arrival of an ack
+         waiting = nAckers;          // ... of all the acks
+         memset(ackedBy, FALSE, nAckers);
 	 i++;                        // points to next message for next time
       }
+      if(timeout == 0) timeout = -1;  // nothing to send before a frame arrives
+      if(rtoDue != 0 && (timeout == -1 || (rtoDue - now + 999) / 1000 < timeout))
+         timeout = (rtoDue - now + 999) / 1000;
 
       // Reception de messages 
-      flag = readMessage(msg, &source, idStn); 
-      if(flag == MSG_ACK)  // Acknowledgement received
+      flag = readMessage(msg, &source, &seq, &syn, idStn, timeout); 
+      if(flag == MSG_EMPTY) continue;  // time to send the next message
+      if((flag == MSG_ACK || flag == MSG_RECV) && dropFrame()) continue;  // %loss
+      if(flag == MSG_ACK && seq != NO_SEQ && limit > 0)  // Acknowledgement of sequenced messages received
+      {
+          k = ackerOf(source, destAt(dest,0));
+          if(k != -1) acked = (seq - ackBase[k] % SEQ_MOD + SEQ_MOD) % SEQ_MOD;
+          if(k == -1)
+             fprintf(stderr, "Station %c (%d): received an Ack from %c - ignored\n",idStn,getpid(),source);
+          else if(acked > 0 && acked <= top - ackBase[k])  // may cover messages sent before going back
+          {
+             ackBase[k] += acked;
+             dupAcks = 0;
+             low = lowestBase(ackBase, nAckers);
+             now = nowUsec();
+             if(low > base) loadAck(base, low, now);
+             base = low;
+             if(i < base) i = base;
+             rtoAcked(base, i, now);
+             if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c an acknowledgement up to %d\n", idStn, getpid(), source, ackBase[k]);
+          }
+          else if(ackBase[k] < i && base >= recover && ++dupAcks == DUP_ACKS)
+          {
+             if(verbose) fprintf(stderr,"Station %c (%d): messages from %d lost - sending them again\n", idStn, getpid(), base);
+             i = base;
+             dupAcks = 0;
+             recover = top;
+             timed = -1;  // the timer restarts with the first message sent again
+             rtoDue = 0;
+          }
+      }
+      else if(flag == MSG_ACK)  // Acknowledgement received
       {
-          if(source == dest) // check out the source
+          k = i > 0 && !ackFlag ? ackerOf(source, destAt(dest,i-1)) : -1;
+          if(k != -1 && !ackedBy[k]) // check out the source
           { 
-	    ackFlag = TRUE;   
-            fprintf(stderr,"Station %c (%d): Received from station %c an acknowledgement\n", idStn, getpid(), source, msg);
+            ackedBy[k] = TRUE;
+            if(--waiting == 0) // all the acknowledgements are in
+            {
+	       ackFlag = TRUE;   
+               now = nowUsec();
+               loadAck(i-1, i, now);
+               rtoAcked(i, i, now);
+            }
+            if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c an acknowledgement\n", idStn, getpid(), source);
           } 
-	  else fprintf(stderr, "Station %c (%d): received an Ack from %c - ignored\n",idStn,getpid(),source);
+	  else if(verbose) fprintf(stderr, "Station %c (%d): received an Ack from %c - ignored\n",idStn,getpid(),source);
+      }
+      else if(flag == MSG_RECV && seq != NO_SEQ) 
+      {     // Received a sequenced message - accept it only if it is the next one expected
+         if(syn != 0 && syn != sessions[(unsigned char) source])
+         {  // the source started again (attached again under its identifier)
+            sessions[(unsigned char) source] = syn;
+            expected[(unsigned char) source] = 0;
+         }
+         diff = (seq - expected[(unsigned char) source] + SEQ_MOD) % SEQ_MOD;
+         if(diff == 0)
+         {
+            if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c >%s< (%d)\n", idStn, getpid(), source, msg, seq);
+            expected[(unsigned char) source] = (seq + 1) % SEQ_MOD;
+         }
+         else if(diff >= SEQ_MOD/2)  // behind the one expected: accepted already, its Ack was lost or late
+         {
+            duplicates++;
+            if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c message %d again - ignored\n",
+                                idStn, getpid(), source, seq);
+         }
+         else
+         {
+            outOfSeq++;
+            if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c message %d out of sequence (expected %d) - ignored\n",
+                                idStn, getpid(), source, seq, expected[(unsigned char) source]);
+         }
+         sendFrame(source,idStn,expected[(unsigned char) source],0,ACKNOWLEDGEMENT);
       }
       else if(flag == MSG_RECV) 
       {     // Received a message - msg contains it, source gives id station that sent it
-         fprintf(stderr,"Station %c (%d): Received from station %c >%s<\n", idStn, getpid(), source, msg);
-         sprintf(msg,"%c%c%c-%s%c",STX,source,idStn,ACKNOWLEDGEMENT,ETX); // envoie acquittement
-         write(1,msg,strlen(msg));
+         if(verbose) fprintf(stderr,"Station %c (%d): Received from station %c >%s<\n", idStn, getpid(), source, msg);
+         sendFrame(source,idStn,NO_SEQ,0,ACKNOWLEDGEMENT); // envoie acquittement
       }
       else if(flag == FINISH) break; // comms channel (pipe) was closed
       else // fatal or unknown error
          fprintf(stderr,"Station %c (%d): unknown value returned by readMessage (%d)\n",idStn,getpid(),flag);
    }
+   if(loadCount > 0) loadReport(idStn);
+   if(retransmits > 0 || duplicates > 0 || outOfSeq > 0 || framesLost > 0)
+      fprintf(stderr,"Station %c (%d): %d messages sent again (%d timeouts, rto %d ms), %d duplicates and %d out of sequence dropped, %d frames lost (%%loss)\n",
+              idStn, getpid(), retransmits, timeouts, rto, duplicates, outOfSeq, framesLost);
+   if(srcRing != NULL)
+      fprintf(stderr,"Station %c (%d): %d messages read from %s\n",idStn,getpid(),srcRead,srcPath);
+}
+
+/*-------------------------------------------------------------
+Function: messageAt
+Parameters: 
+	messages - array of pointers to messages for transmission
+	i        - index of the message
+Description:
+   Returns message i: messages[i], the generated message while
+   i < loadCount with %load, or with %source the line i of the file
+   (read when first needed).  Returns NULL after the last message.
+   With %source, i is never more than window messages before the
+   last one read.
+-------------------------------------------------------------*/
+char *messageAt(char *messages[], int i)
+{
+   if(loadCount > 0) return(i < loadCount ? loadMsg : NULL);
+   if(srcRing == NULL) return(messages[i]);
+   while(srcRead <= i && sourceNext(srcRing + (size_t) (srcRead % srcSlots) * (SOURCE_MAX+1)))
+      srcRead++;
+   return(i < srcRead ? srcRing + (size_t) (i % srcSlots) * (SOURCE_MAX+1) : NULL);
+}
+
+/*-------------------------------------------------------------
+Function: sourceOpen
+Description:
+   Opens the file of %source (waiting for a writer if it is a
+   FIFO), maps it if it is a regular file, and allocates the ring
+   of the messages not yet acknowledged.  Exits on error.
+-------------------------------------------------------------*/
+void sourceOpen()
+{
+   struct stat st;
+
+   srcFd = open(srcPath, O_RDONLY);
+   if(srcFd == -1 || fstat(srcFd, &st) == -1)
+   {
+      perror(srcPath);
+      exit(-1);
+   }
+   if(S_ISREG(st.st_mode) && st.st_size > 0)
+   {
+      srcSize = st.st_size;
+      srcMap = mmap(NULL, srcSize, PROT_READ, MAP_PRIVATE, srcFd, 0);
+      if(srcMap == MAP_FAILED)
+      {
+         perror(srcPath);
+         exit(-1);
+      }
+      madvise(srcMap, srcSize, MADV_SEQUENTIAL);
+   }
+   srcSlots = (window > 0 ? window : 1) + 1;  // see communication()
+   srcRing = malloc((size_t) srcSlots * (SOURCE_MAX+1));
+   if(srcRing == NULL)
+   {
+      perror("stn: source");
+      exit(-1);
+   }
+}
+
+/*-------------------------------------------------------------
+Function: sourceNext
+Parameters:
+	msg - buffer of SOURCE_MAX+1 bytes receiving the message
+Description:
+   Reads the next line of the file of %source into msg (without
+   its \n, cut to SOURCE_MAX bytes; empty lines are skipped).  In
+   a mapping, the pages before the line are released from memory
+   every SOURCE_DROP bytes; otherwise the file is read into srcBuf,
+   blocking until a FIFO has data.  Returns FALSE at the end of the
+   file.
+-------------------------------------------------------------*/
+int sourceNext(char *msg)
+{
+   char *line;       // start of the line
+   char *end;        // its \n (or the end of the data)
+   int len;
+   int n;
+   long page = sysconf(_SC_PAGESIZE);
+
+   while(1)
+   {
+      if(srcMap != NULL)
+      {
+         if(srcPos >= srcSize) return(FALSE);
+         line = srcMap + srcPos;
+         end = memchr(line, '\n', srcSize - srcPos);
+         if(end == NULL) end = srcMap + srcSize;
+         srcPos = end - srcMap + 1;
+         if(srcPos - srcReleased >= SOURCE_DROP && srcPos < srcSize)
+         {
+            madvise(srcMap + srcReleased, srcPos / page * page - srcReleased, MADV_DONTNEED);
+            srcReleased = srcPos / page * page;
+         }
+      }
+      else
+      {
+         end = memchr(srcBuf, '\n', srcLen);
+         if(srcSkip)  // rest of a line already sent
+         {
+            n = end != NULL ? end - srcBuf + 1 : srcLen;
+            srcLen -= n;
+            memmove(srcBuf, srcBuf + n, srcLen);
+            srcSkip = end == NULL;
+            end = memchr(srcBuf, '\n', srcLen);
+         }
+         if(end == NULL && !srcEof && srcLen < BUFSIZ)
+         {
+            n = read(srcFd, srcBuf + srcLen, BUFSIZ - srcLen);
+            if(n == -1 && errno == EINTR) continue;
+            if(n == -1) perror(srcPath);
+            if(n <= 0) srcEof = TRUE;
+            else srcLen += n;
+            continue;
+         }
+         if(end == NULL && srcLen == 0) return(FALSE);  // end of the file
+         if(end == NULL && srcLen == BUFSIZ) srcSkip = TRUE;  // line longer than srcBuf
+         if(end == NULL) end = srcBuf + srcLen;  // last line
+         line = srcBuf;
+      }
+      len = end - line < SOURCE_MAX ? end - line : SOURCE_MAX;
+      memcpy(msg, line, len);
+      msg[len] = '\0';
+      if(srcMap == NULL)
+      {
+         n = end - srcBuf + (end < srcBuf + srcLen);  // the line and its \n
+         srcLen -= n;
+         memmove(srcBuf, srcBuf + n, srcLen);
+      }
+      if(len > 0) return(TRUE);
+   }
+}
+
+/*-------------------------------------------------------------
+Function: destAt
+Parameters: 
+	dest - destination identifier
+	i    - index of the message
+Description:
+   Returns the destination of message i: dest, or the destinations
+   of %load in turn.
+-------------------------------------------------------------*/
+char destAt(char dest, int i)
+{
+   if(*loadDests == '\0') return(dest);
+   return(loadDests[i % strlen(loadDests)]);
+}
+
+/*-------------------------------------------------------------
+Function: ackerOf
+Parameters:
+	source - station that sent an acknowledgement
+	dest   - destination of the message acknowledged
+Description:
+   Returns the index of source among the stations that acknowledge
+   each message: in ackers (%acks), or 0 if ackers is empty and
+   source is dest.  Returns -1 for any other station.
+-------------------------------------------------------------*/
+int ackerOf(char source, char dest)
+{
+   char *pt;
+
+   if(*ackers == '\0') return(source == dest ? 0 : -1);
+   pt = strchr(ackers, source);
+   return(pt != NULL && source != '\0' ? pt - ackers : -1);
+}
+
+/*-------------------------------------------------------------
+Function: lowestBase
+Parameters:
+	ackBase - next message each station must acknowledge
+	n       - number of stations
+Description:
+   Returns the lowest of ackBase[0] to ackBase[n-1]: the oldest
+   message not acknowledged by all the stations.
+-------------------------------------------------------------*/
+int lowestBase(int *ackBase, int n)
+{
+   int low = ackBase[0];
+   int k;
+
+   for(k=1; k<n; k++)
+      if(ackBase[k] < low) low = ackBase[k];
+   return(low);
+}
+
+/*-------------------------------------------------------------
+Function: sendDelay
+Parameters: 
+	i   - index of the message
+	now - current time (usec)
+Description:
+   Returns 0 if message i can be sent now, otherwise the number of
+   milliseconds until it can be (message i is due i/loadRate
+   seconds after the first one).
+-------------------------------------------------------------*/
+int sendDelay(int i, long long now)
+{
+   long long due;
+
+   if(loadRate == 0 || i == 0) return(0);
+   due = loadFirst + (long long) (i * 1000000.0 / loadRate);
+   if(due <= now) return(0);
+   return((due - now + 999) / 1000);
+}
+
+/*-------------------------------------------------------------
+Function: loadInit
+Description:
+   Builds the message generated by %load and allocates the arrays
+   of the round-trip times.  Sequence numbers are only checked
+   against a single destination, so the window is not used with
+   several destinations.
+-------------------------------------------------------------*/
+void loadInit()
+{
+   int k;
+
+   loadMsg = malloc(loadSize+1);
+   sentAt = calloc(loadCount, sizeof(long long));
+   rtts = malloc(loadCount * sizeof(int));
+   if(loadMsg == NULL || sentAt == NULL || rtts == NULL)
+   {
+      perror("stn: load");
+      exit(-1);
+   }
+   for(k=0; k<loadSize; k++)
+      loadMsg[k] = 'a' + k % 26;
+   loadMsg[loadSize] = '\0';
+   if(window > 0 && strlen(loadDests) > 1)
+   {
+      fprintf(stderr,"stn: the window is not used with several destinations\n");
+      window = 0;
+   }
+}
+
+/*-------------------------------------------------------------
+Function: loadSent
+Parameters: 
+	i   - index of the message
+	now - current time (usec)
+Description:
+   Records the time of the first transmission of message i (%load).
+-------------------------------------------------------------*/
+void loadSent(int i, long long now)
+{
+   if(loadCount == 0 || sentAt[i] != 0) return;
+   sentAt[i] = now;
+   if(i == 0) loadFirst = now;
+}
+
+/*-------------------------------------------------------------
+Function: loadAck
+Parameters: 
+	from - first message acknowledged
+	to   - message after the last one acknowledged
+	now  - current time (usec)
+Description:
+   Records the round-trip time of the messages acknowledged (%load).
+-------------------------------------------------------------*/
+void loadAck(int from, int to, long long now)
+{
+   if(loadCount == 0) return;
+   for( ; from < to; from++)
+      rtts[loadAcked++] = now - sentAt[from];
+   loadLast = now;
+}
+
+/*-------------------------------------------------------------
+Function: loadReport
+Parameters: 
+	idStn - station identifier
+Description:
+   Prints the number of messages acknowledged and their rate.  With
+   %stats, also writes to the file a line
+      idStn acked bytes first last
+   (first and last: CLOCK_MONOTONIC times in usec of the first
+   transmission and of the last acknowledgement) followed by the
+   round-trip time in usec of each message acknowledged, one per line.
+-------------------------------------------------------------*/
+void loadReport(char idStn)
+{
+   FILE *fp;
+   char tmpName[BUFSIZ+4];  // the file is written under this name, then renamed
+   int k;
+   double secs = (loadLast - loadFirst) / 1000000.0;
+
+   fprintf(stderr,"Station %c (%d): %d of %d messages acknowledged in %.3f s (%.0f messages/s)\n",
+           idStn, getpid(), loadAcked, loadCount, secs, secs > 0 ? loadAcked / secs : 0.0);
+   if(*loadStats == '\0') return;
+   snprintf(tmpName, sizeof(tmpName), "%s.tmp", loadStats);
+   fp = fopen(tmpName, "w");
+   if(fp == NULL)
+   {
+      perror(tmpName);
+      return;
+   }
+   fprintf(fp, "%c %d %lld %lld %lld\n", idStn, loadAcked, (long long) loadAcked * loadSize, loadFirst, loadLast);
+   for(k=0; k<loadAcked; k++)
+      fprintf(fp, "%d\n", rtts[k]);
+   fclose(fp);
+   rename(tmpName, loadStats);  // the file appears complete
+}
+
+/*-------------------------------------------------------------
+Function: rtoSent
+Parameters: 
+	i   - index of the message
+	now - current time (usec)
+Description:
+   Records the transmission of message i: counts it if it is sent
+   again, otherwise times it if no message is timed, and starts the
+   retransmission timer if it is not running.
+-------------------------------------------------------------*/
+void rtoSent(int i, long long now)
+{
+   if(i < top) retransmits++;
+   else
+   {
+      top = i+1;
+      if(timed == -1)
+      {
+         timed = i;
+         timedAt = now;
+      }
+   }
+   if(rtoDue == 0) rtoDue = now + rto * 1000LL;
+}
+
+/*-------------------------------------------------------------
+Function: rtoAcked
+Parameters: 
+	base - oldest message not acknowledged
+	next - next message to send
+	now  - current time (usec)
+Description:
+   Called when messages are acknowledged: measures the round-trip
+   time of the message timed if it is one of them, drops the
+   doubling of the timeout, and restarts the retransmission timer
+   for the messages still waiting (stops it if none is).
+-------------------------------------------------------------*/
+void rtoAcked(int base, int next, long long now)
+{
+   if(timed != -1 && timed < base)
+   {
+      rtoSample(now - timedAt);
+      timed = -1;
+   }
+   rto = rtoEstimate;
+   rtoDue = base < next ? now + rto * 1000LL : 0;
+}
+
+/*-------------------------------------------------------------
+Function: rtoExpired
+Description:
+   Called when the retransmission timer expires: doubles the
+   timeout (up to RTO_MAX) until the next acknowledgement (see
+   rtoAcked()), and stops timing the message timed (it will be sent
+   again).  The timer restarts with the next message sent.
+-------------------------------------------------------------*/
+void rtoExpired()
+{
+   timeouts++;
+   rto = rto*2 < RTO_MAX ? rto*2 : RTO_MAX;
+   timed = -1;
+   rtoDue = 0;
+}
+
+/*-------------------------------------------------------------
+Function: rtoSample
+Parameters: 
+	usec - round-trip time measured
+Description:
+   Updates the smoothed round-trip time and its deviation with the
+   measure, and sets rtoEstimate to srtt + 4*rttvar within RTO_MIN
+   and RTO_MAX (Jacobson's estimator, gains 1/8 and 1/4).
+-------------------------------------------------------------*/
+void rtoSample(long long usec)
+{
+   if(srtt == 0)
+   {
+      srtt = usec > 0 ? usec : 1;
+      rttvar = usec / 2;
+   }
+   else
+   {
+      rttvar += (llabs(srtt - usec) - rttvar) / 4;
+      srtt += (usec - srtt) / 8;
+   }
+   rtoEstimate = (srtt + 4 * rttvar + 999) / 1000;
+   if(rtoEstimate < RTO_MIN) rtoEstimate = RTO_MIN;
+   if(rtoEstimate > RTO_MAX) rtoEstimate = RTO_MAX;
+}
+
+/*-------------------------------------------------------------
+Function: dropFrame
+Description:
+   Returns TRUE for lossRate percent of the frames received (%loss),
+   chosen at random, and counts them.
+-------------------------------------------------------------*/
+int dropFrame()
+{
+   if(lossRate == 0 || random() >= lossRate / 100 * RAND_MAX) return(FALSE);
+   framesLost++;
+   return(TRUE);
+}
+
+/*-------------------------------------------------------------
+Function: nowUsec
+Description:
+   Returns the current time in microseconds (CLOCK_MONOTONIC).
+-------------------------------------------------------------*/
+long long nowUsec()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+}
+
+/*-------------------------------------------------------------
+Function: sendFrame
+Parameters: 
+	dest  - destination identifier
+	idStn - station identifier
+	seq   - sequence number, or NO_SEQ
+	syn   - session marking the message (0: none, see frame.h)
+	msg   - message to send
+Description:
+   Builds the frame for the message (see extractMessage() for the
+   format; a binary frame once the hub has accepted them) and writes
+   it to the hub.
+-------------------------------------------------------------*/
+void sendFrame(char dest, char idStn, int seq, int syn, char *msg)
+{
+   char frame[BUFSIZ];
+   int len;
+
+   if(binary)
+   {
+      len = strlen(msg) < BIN_MAX_LEN ? strlen(msg) : BIN_MAX_LEN;
+      memset(frame, 0, BIN_HDR_LEN);
+      frame[0] = BIN_MAGIC;
+      frame[DEST_POS] = dest;
+      frame[SRC_POS] = idStn;
+      frame[BIN_VERSION_POS] = binary;
+      frame[BIN_TYPE_POS] = strcmp(msg, ACKNOWLEDGEMENT) == 0 ? BIN_ACK : BIN_MSG;
+      if(frame[BIN_TYPE_POS] == BIN_ACK) len = 0;
+      if(seq != NO_SEQ)
+      {
+         frame[BIN_FLAGS_POS] = BIN_F_SEQ | (syn != 0 ? BIN_F_SYN : 0);
+         BIN_PUT32(frame+BIN_SEQ_POS, (unsigned) syn << 16 | seq);
+      }
+      BIN_PUT16(frame+BIN_LEN_POS, len);
+      memcpy(frame+BIN_HDR_LEN, msg, len);
+      writeHub(frame, BIN_HDR_LEN+len);
+      return;
+   }
+   if(seq == NO_SEQ)
+      snprintf(frame,BUFSIZ,"%c%c%c-%s%c",STX,dest,idStn,msg,ETX);
+   else if(syn != 0)
+      snprintf(frame,BUFSIZ,"%c%c%c%c%0*x%0*x%s%c",STX,dest,idStn,SYN_SEP,SEQ_LEN,syn,SEQ_LEN,seq,msg,ETX);
+   else
+      snprintf(frame,BUFSIZ,"%c%c%c%c%0*x%s%c",STX,dest,idStn,SEQ_SEP,SEQ_LEN,seq,msg,ETX);
+   writeHub(frame,strlen(frame));  // writes to the standard output, i.e. pipe
 }
 
 /*-------------------------------------------------------------
@@ -202,11 +1105,15 @@ Function: readMessage
 Parameters: 
 	msg	  - pointer to buffer for storing received message
 	sourcePtr - pointer to a character to receive source identifier
+	seqPtr    - pointer to receive the sequence number (or NO_SEQ)
+	synPtr    - pointer to receive the session of the message (or 0)
+	timeout   - maximum wait for data in msec (-1: no limit)
 Description:
     Reads in a buffer of many frames (or 1) from the standard input (i.e.
-    pipe).  If the standard input is closed, return FINISH. Note that the 
-    buffer allFrames is static and does not disappear between calls
-    to the function.
+    pipe).  If the standard input is closed, return FINISH.  If no data
+    arrives within timeout, return MSG_EMPTY. Note that the 
+    circular buffer allFrames is static and does not disappear between
+    calls to the function.
 
     If frames have been received, call extractMessage() to extract the
     first message; it returns MSG_ACK if an acknowledgement is found or
@@ -214,7 +1121,10 @@ Description:
     referenced by buffer).  Messages are removed from allFrames by 
     extractMessage(). Note that extractMessage ignore frames not addressed
     to this station process (i.e. the destination ident. is not equal to
-    idStn).  Once allFrames is empty, fill it again from the standard input.
+    idStn).  Once allFrames holds no complete frame, more data is read
+    from the standard input after the incomplete frame, if any, into
+    the free space that follows it (up to the end of the data array;
+    the next read continues at its start).
 
     Thus this function scans the standard input for messages until it
     finds one destined for station process idStn or until the standard input
@@ -222,40 +1132,45 @@ Description:
 
     See extractMessage() for frame format.
 -------------------------------------------------------------*/
-int readMessage(char *msg, char *sourcePtr, char idStn)
+int readMessage(char *msg, char *sourcePtr, int *seqPtr, int *synPtr, char idStn, int timeout)
 {
-   static char allFrames[BUFSIZ];  // all frames read from pipe - static buffer
+   static struct rxBuffer allFrames;  // all frames read from pipe - static buffer
    int ret;			   // value returned by this function
    int retRead;			   // to store value returned by read and extractMessage function
+   unsigned pos;                   // position of the free space in allFrames.data
+   unsigned space;                 // free space after pos
    char msgErreur[BUFSIZ];         // buffer to build error messages
    
    while(1) // Loop to find a message
    {
-      if(*allFrames == '\0') // buffer empty - need to read from the pipe
-      {
-        retRead = read(0,allFrames,BUFSIZ-1); // blocks when pipe is empty
-	if(retRead == -1) 
-	{
-            sprintf(msgErreur,"Station %c (%d): reading error",msgErreur,idStn);
-            perror(msgErreur);
-	}
-	else if(retRead == 0) // write end of pipe has been closed
-	{
-	    ret = FINISH;
-	    break;  // break out of loop
-	}
-	// messages are in the buffer
-	allFrames[retRead]='\0';  // terminate the string
-      }
-      // The following line can be used for debugging
-      //fprintf(stderr,"Station %c (%d): readMessage >%s<\n", idStn, getpid(), allFrames);
-      retRead = extractMessage(msg, allFrames, sourcePtr, idStn);
+      retRead = extractMessage(msg, &allFrames, sourcePtr, seqPtr, synPtr, idStn);
       if(retRead != MSG_EMPTY) // if MSG_EMPTY, no messages were found in the buffer 
       {
           ret = retRead;  // is MSG_ACK or MSG_RECV
 	  break;
       }
       // if we get here, need to read from the pipe again
+      // (extractMessage() leaves less than BUFSIZ bytes, so there is always free space)
+      pos = allFrames.wr & (RX_SIZE-1);
+      space = RX_SIZE - (allFrames.wr - allFrames.rd);
+      if(space > RX_SIZE - pos) space = RX_SIZE - pos;
+      if(timeout >= 0 && waitHub(timeout) == 0)
+      {
+          ret = MSG_EMPTY;
+          break;  // nothing arrived in time
+      }
+      retRead = readHub(allFrames.data+pos,space); // blocks when pipe is empty
+      if(retRead == -1) 
+      {
+          sprintf(msgErreur,"Station %c (%d): reading error",idStn,getpid());
+          perror(msgErreur);
+      }
+      else if(retRead == 0) // write end of pipe has been closed
+      {
+          ret = FINISH;
+          break;  // break out of loop
+      }
+      else allFrames.wr += retRead;  // messages are in the buffer
    }
    return(ret);
 }
@@ -265,69 +1180,315 @@ Function: extractMessage
 
 Parameters:
     msg		- points to buffer to receive a message
-    aframes 	- points to buffer of received frames
+    rx   	- points to the circular buffer of received frames
     sourcePtr   - to returne the identifier of the source 
+    seqPtr      - to return the sequence number (NO_SEQ if none)
+    synPtr      - to return the session of the message (0 if none)
     idStn       - this stations identifier
 
 Description: 
-     Extracts a message from the buffer referenced by aframes.
+     Extracts a message from the circular buffer referenced by rx.
      The message is removed and copied to the buffer referenced
-     by msg. Frames with improper destination id are skipped.
+     by msg. Frames with improper destination id are skipped (those
+     for BROADCAST_ID and for the groups are kept).
+     An incomplete frame at the end of the buffer is left in it.
+     Removing a frame only advances the read cursor, and each frame
+     is examined where it is (see rxView()), so the cost of a frame
+     does not depend on the number of frames in the buffer.  The
+     frames are found FRAME_BATCH at a time by scanFrames(), and
+     frames for other stations are skipped using only the index it
+     returns.
 
-     Message format: STX D S <message> ETX
+     Message format: STX D S - <message> ETX
+                  or STX D S # <seq> <message> ETX
+                  or STX D S ! <session> <seq> <message> ETX
+                  or a binary frame (see frame.h)
      D must be equal to idStn to gain attention
      S gives the ident. of the station that sent the message 
+     <seq> - sequence number (see frame.h)
      <message> - string of characters
      If STX is missing, print an error and skip the message.
+     A BIN_HELLO frame from the hub sets the version of the binary
+     frames to use (binary).
 ------------------------------------------------*/
-int extractMessage(char *msg, char *aframes, char *sourcePtr, char idStn)
+int extractMessage(char *msg, struct rxBuffer *rx, char *sourcePtr, int *seqPtr, int *synPtr, char idStn)
 {
-   char *pt=aframes;       // pointer to navigate the buffer of all frames
-   int retcd = MSG_EMPTY;  // return value 
+   static char scratch[BUFSIZ];      // copy of a frame that wraps around the end of rx->data
+   static struct frameRef refs[FRAME_BATCH];  // frames found at the read cursor
+   static char *refsBase;            // buffer scanned for refs
+   static int nRefs = 0;             // number of frames in refs
+   static int iRef = 0;              // next frame of refs to examine
+   char *end;                        // end of the bytes scanned
+   int consumed;                     // bytes covered by the frames found
+   int retcd = MSG_EMPTY;            // return value 
+   char *pt;                         // the frame
+   int len;                          // length of the frame
+   char *msgPt;                      // message in the frame
 
    while(1) // find a message for this station
    {
-      if(*pt == '\0') // no messages
-      {
-         retcd = MSG_EMPTY;
-	 *aframes = '\0';  // empties the all frames buffer
-         break; // break the loop
-      }
-      else if(*pt != STX) // found an error - no STX
+      if(iRef == nRefs) // all frames found have been examined - scan the next ones
       {
-	  fprintf(stderr,"stn(%c,%d): no STX: >%s<\n",idStn,getpid(),pt);
-          while(*pt != ETX && *pt != STX && *pt != '\0') pt++;  // skip until the end or beginning 
-	  if(*pt == ETX) pt++; 					// skip the ETX
+         if(rx->rd == rx->wr) // no messages
+         {
+            retcd = MSG_EMPTY;
+            break; // break the loop
+         }
+         refsBase = rxView(rx, scratch, &end);
+         nRefs = scanFrames(refsBase, end - refsBase, refs, FRAME_BATCH, &consumed);
+         iRef = 0;
+         if(nRefs == 0 && end - refsBase < BUFSIZ) // incomplete message
+         {
+            retcd = MSG_EMPTY;
+            break; // break the loop
+         }
+         else if(nRefs == 0) // frame too long - drop its first byte
+         {
+            refs[0].offset = 0;
+            refs[0].len = 1;
+            refs[0].kind = FRAME_JUNK;
+            nRefs = 1;
+         }
       }
-      else if(*(pt+DEST_POS) != idStn)  // not my message - ignore
-      {
+      pt = refsBase + refs[iRef].offset;
+      len = refs[iRef].len;
+      rx->rd += len;  // remove the frame
+      if(refs[iRef].kind == FRAME_JUNK) // found an error - no STX
+	  fprintf(stderr,"stn(%c,%d): no STX: >%.*s<\n",idStn,getpid(),len,pt);
+      else if((refs[iRef].dest != (unsigned char) idStn && refs[iRef].dest != BROADCAST_ID
+               && !IS_GROUP(refs[iRef].dest))
+              || (refs[iRef].kind == FRAME_TEXT && len > SEP_POS && pt[SEP_POS] == JOIN_SEP))
+      {   // not my message (or a join frame flooded by the hub) - ignore
           // The following lines can be used for debugging
-          //fprintf(stderr,"stn (%c,%d): Skipping message destined to another destination: >%s<\n",
-          //               idStn, getpid(), pt);  
-          while(*pt != ETX && *pt != '\0') pt++;  // skip to the end
-	  if(*pt == ETX) pt++; 			  // skip the ETX
+          //fprintf(stderr,"stn (%c,%d): Skipping message destined to another destination: >%.*s<\n",
+          //               idStn, getpid(), len, pt);  
       }
-      else if(strncmp(pt+MSG_POS,ACKNOWLEDGEMENT,strlen(ACKNOWLEDGEMENT)) == 0) // found an ACK message
+      else if(refs[iRef].kind == FRAME_BIN && pt[BIN_TYPE_POS] == BIN_HELLO)
       {
-         *sourcePtr = *(pt+SRC_POS);             // to return the source ident.
-         retcd = MSG_ACK;
-	 *msg == '\0';
-         while(*pt != ETX && *pt != '\0') pt++;  // skip to the end
-	 if(*pt == ETX) pt++;                    // skip the ETX
-	 strcpy(aframes,pt);                     // move unread frames to the start of the buffer
-	 break;
+          binary = pt[BIN_VERSION_POS];  // answer of the hub
+          fprintf(stderr,"Station %c (%d): %s\n",idStn,getpid(),binary ? "using binary frames" : "hub refused binary frames");
       }
-      else // found a message
+      else
       {
-         *sourcePtr = *(pt+SRC_POS);                       // to return the source ident.
-         retcd = MSG_RECV;
-	 pt = pt+MSG_POS;                                  // point to the message
-         while(*pt != ETX && *pt != '\0') *msg++ = *pt++;  // copy message into buffer
-	 if(*pt == ETX) pt++;                              // skip the ETX
-	 *msg = '\0';                                      // terminate the string
-	 strcpy(aframes,pt);                               // move unread frames to the start of the buffer
-	 break;
+         msgPt = frameMessage(pt,len,seqPtr,synPtr);
+         *sourcePtr = *(pt+SRC_POS);  // to return the source ident.
+         if(refs[iRef].kind == FRAME_BIN ? pt[BIN_TYPE_POS] == BIN_ACK
+            : strncmp(msgPt,ACKNOWLEDGEMENT,strlen(ACKNOWLEDGEMENT)) == 0) // found an ACK message
+         {
+            retcd = MSG_ACK;
+	    *msg = '\0';
+         }
+         else // found a message
+         {
+            retcd = MSG_RECV;
+            memcpy(msg, msgPt, pt+len-msgPt);    // copy message into buffer
+            if(*pt == STX)
+               msg[pt+len-1-msgPt] = '\0';      // terminate the string (replaces the ETX)
+            else
+               msg[pt+len-msgPt] = '\0';        // terminate the string
+         }
       }
+      iRef++;
+      if(retcd != MSG_EMPTY) break;
    }
    return(retcd);
 }
+
+/*------------------------------------------------
+Function: rxView
+
+Parameters:
+    rx      - points to the circular buffer of received frames (not empty)
+    scratch - buffer of BUFSIZ bytes
+    endPtr  - to return the end of the bytes available
+Description: 
+     Returns a pointer to the bytes at the read cursor of rx, as one
+     contiguous block: in place when the frame at the read cursor
+     does not wrap around the end of rx->data, otherwise copied
+     (at most BUFSIZ bytes, the largest frame) into scratch.
+------------------------------------------------*/
+char *rxView(struct rxBuffer *rx, char *scratch, char **endPtr)
+{
+   unsigned pos = rx->rd & (RX_SIZE-1);
+   unsigned avail = rx->wr - rx->rd;
+   unsigned first = RX_SIZE - pos;  // bytes before the end of rx->data
+
+   if(avail <= first || frameLength(rx->data+pos, rx->data+RX_SIZE) != 0)
+   {
+      *endPtr = rx->data + pos + (avail < first ? avail : first);
+      return(rx->data+pos);
+   }
+   if(avail > BUFSIZ) avail = BUFSIZ;
+   memcpy(scratch, rx->data+pos, first);
+   memcpy(scratch+first, rx->data, avail-first);
+   *endPtr = scratch + avail;
+   return(scratch);
+}
+
+/*------------------------------------------------
+Function: frameMessage
+
+Parameters:
+    frame  - points to a complete frame
+    len    - length of the frame
+    seqPtr - to return the sequence number (NO_SEQ if none)
+    synPtr - to return the session (0 if none)
+Description: 
+     Returns a pointer to the message in the frame: after the
+     header of a binary frame, after the sequence number (and the
+     session) of a text frame if it has valid ones, at MSG_POS
+     otherwise (at the ETX of a frame too short to hold a message).
+------------------------------------------------*/
+char *frameMessage(char *frame, int len, int *seqPtr, int *synPtr)
+{
+   int seq;
+   int syn;
+
+   *seqPtr = NO_SEQ;
+   *synPtr = 0;
+   if((unsigned char) *frame == BIN_MAGIC)
+   {
+      if(frame[BIN_FLAGS_POS] & BIN_F_SEQ) *seqPtr = BIN_GET32(frame+BIN_SEQ_POS) % SEQ_MOD;
+      if(frame[BIN_FLAGS_POS] & BIN_F_SYN) *synPtr = BIN_GET32(frame+BIN_SEQ_POS) / SEQ_MOD;
+      return(frame+BIN_HDR_LEN);
+   }
+   if(len <= MSG_POS) return(frame+len-1);
+   if(*(frame+SEP_POS) == SYN_SEP && len > SYN_MSG_POS)
+   {
+      syn = hexField(frame+SEQ_POS);
+      seq = hexField(frame+SEQ_MSG_POS);
+      if(syn <= 0 || seq == -1) return(frame+MSG_POS);
+      *synPtr = syn;
+      *seqPtr = seq;
+      return(frame+SYN_MSG_POS);
+   }
+   if(*(frame+SEP_POS) != SEQ_SEP || len <= SEQ_MSG_POS) return(frame+MSG_POS);
+   seq = hexField(frame+SEQ_POS);
+   if(seq == -1) return(frame+MSG_POS);
+   *seqPtr = seq;
+   return(frame+SEQ_MSG_POS);
+}
+
+/*------------------------------------------------
+Function: hexField
+
+Parameters:
+    pt - SEQ_LEN characters of a frame
+Description: 
+     Returns the value of the SEQ_LEN hexadecimal digits at pt,
+     or -1 if one of the characters is not a digit.
+------------------------------------------------*/
+int hexField(char *pt)
+{
+   int value = 0;
+   int i;
+
+   for(i=0 ; i < SEQ_LEN ; i++)
+   {
+      if(!isxdigit((unsigned char) pt[i])) return(-1);
+      value = value*16 + (isdigit((unsigned char) pt[i]) ? pt[i]-'0' : tolower(pt[i])-'a'+10);
+   }
+   return(value);
+}
+
+/*------------------------------------------------
+Function: readHub
+
+Parameters:
+    buf - buffer to receive the data
+    len - size of buf
+Description:
+     Reads data sent by the hub: from the standard input, or from
+     the reception ring of the shared memory link.  Blocks until
+     data is available and returns the number of bytes read, 0 when
+     the hub has closed the pipe (or ring), or -1 on error.
+------------------------------------------------*/
+int readHub(char *buf, int len)
+{
+   if(hubLink == NULL)
+      return(read(0,buf,len));
+   return(ringReadWait(&hubLink->down, buf, len, fdSpace, fdWake));
+}
+
+/*------------------------------------------------
+Function: stallHub
+
+Description:
+     Waits until the hub closes the pipe (or ring) without reading
+     anything from it (%stall): poll() reports the end of the pipe
+     even while data is left in it, and the hub wakes the station
+     up when it closes the ring.
+------------------------------------------------*/
+void stallHub()
+{
+   struct pollfd pfd;
+
+   if(hubLink != NULL)
+   {
+      while(!atomic_load(&hubLink->down.closed) && eventWait(fdWake) == 0)
+         ;
+      return;
+   }
+   pfd.fd = 0;
+   pfd.events = 0;  // only the end of the pipe (POLLHUP) or an error
+   while(poll(&pfd, 1, -1) == -1 && errno == EINTR)
+      ;
+}
+
+/*------------------------------------------------
+Function: waitHub
+
+Parameters:
+    timeout - maximum wait in msec
+Description:
+     Waits until data sent by the hub can be read without blocking
+     (see readHub()).  Returns 0 if timeout expires first, a positive
+     value otherwise (or -1 on error).
+------------------------------------------------*/
+int waitHub(int timeout)
+{
+   struct pollfd pfd;
+
+   if(hubLink != NULL)
+      return(ringWaitData(&hubLink->down, fdWake, timeout));
+   pfd.fd = 0;
+   pfd.events = POLLIN;
+   return(poll(&pfd, 1, timeout));
+}
+
+/*------------------------------------------------
+Function: hubExited
+
+Parameters:
+    sig - the signal (SIGTERM)
+Description:
+     Called when the hub exits with the shm transport (the hub
+     asks the system to send SIGTERM to the stations then).  Closes
+     both rings of the link so that the station sees the end of the
+     data, as with a pipe, and wakes the station up.
+------------------------------------------------*/
+void hubExited(int sig)
+{
+   (void) sig;
+   atomic_store(&hubLink->down.closed, 1);
+   atomic_store(&hubLink->up.closed, 1);
+   eventSignal(fdWake);
+}
+
+/*------------------------------------------------
+Function: writeHub
+
+Parameters:
+    buf - data to send to the hub
+    len - number of bytes in buf
+Description:
+     Writes the data to the standard output, or to the transmission
+     ring of the shared memory link (waiting while it is full).
+------------------------------------------------*/
+void writeHub(char *buf, int len)
+{
+   if(hubLink == NULL)
+      write(1,buf,len);
+   else
+      ringWriteAll(&hubLink->up, buf, len, fdData, fdWake);
+}
@@ -0,0 +1,263 @@
+/*------------------------------------------------------------
+File: uring.c
+
+Description: Minimal io_uring ring (see uring.h).  Both rings are
+mapped once (IORING_FEAT_SINGLE_MMAP); the tail of the submission
+ring is published with a release store once an entry is filled,
+and the head of the completion ring once a completion has been
+read, as the kernel expects.  Only the thread running the ring
+uses it.
+-------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "uring.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#if !defined(NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING
+#endif
+#endif
+
+#ifdef HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static struct io_uring_sqe *uringEntry(struct uring *);
+
+/*-------------------------------------------------------------
+Function: uringOpen
+Parameters:
+    r       - the ring
+    entries - number of entries of the submission ring (a power of
+              2, at least the number of requests prepared between
+              two calls to uringSubmit(); the completion ring has
+              twice as many)
+Description:
+   Creates the io_uring instance and maps its rings.  Returns 0, or
+   -1 with errno set if the kernel does not provide io_uring (or an
+   io_uring too old for the hub).
+-------------------------------------------------------------*/
+int uringOpen(struct uring *r, unsigned entries)
+{
+   struct io_uring_params p;
+   char *map;
+
+   memset(&p, 0, sizeof(p));
+   r->fd = syscall(__NR_io_uring_setup, entries, &p);
+   if(r->fd == -1) return(-1);
+   if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG))
+   {
+      close(r->fd);
+      r->fd = -1;
+      errno = ENOSYS;
+      return(-1);
+   }
+   r->entries = p.sq_entries;
+   r->ringLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   if(p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > (unsigned long) r->ringLen)
+      r->ringLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   r->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+   r->ringMap = mmap(NULL, r->ringLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+   r->sqes = mmap(NULL, r->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+   if(r->ringMap == MAP_FAILED || r->sqes == MAP_FAILED)
+   {
+      if(r->ringMap != MAP_FAILED) munmap(r->ringMap, r->ringLen);
+      close(r->fd);
+      r->fd = -1;
+      return(-1);
+   }
+   map = r->ringMap;
+   r->sqHead = (unsigned *) (map + p.sq_off.head);
+   r->sqTail = (unsigned *) (map + p.sq_off.tail);
+   r->sqMask = *(unsigned *) (map + p.sq_off.ring_mask);
+   r->sqArray = (unsigned *) (map + p.sq_off.array);
+   r->cqHead = (unsigned *) (map + p.cq_off.head);
+   r->cqTail = (unsigned *) (map + p.cq_off.tail);
+   r->cqMask = *(unsigned *) (map + p.cq_off.ring_mask);
+   r->cqes = map + p.cq_off.cqes;
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: uringClose
+Parameters:
+    r - the ring
+Description:
+   Unmaps the rings and closes the instance; the requests still
+   pending are cancelled by the kernel.
+-------------------------------------------------------------*/
+void uringClose(struct uring *r)
+{
+   if(r->fd == -1) return;
+   munmap(r->sqes, r->sqesLen);
+   munmap(r->ringMap, r->ringLen);
+   close(r->fd);
+   r->fd = -1;
+}
+
+/*-------------------------------------------------------------
+Function: uringEntry
+Parameters:
+    r - the ring
+Description:
+   Returns the next free entry of the submission ring, cleared.
+   When the ring is full, what it holds is submitted first.
+-------------------------------------------------------------*/
+static struct io_uring_sqe *uringEntry(struct uring *r)
+{
+   unsigned tail = *r->sqTail;
+   struct io_uring_sqe *sqe;
+
+   while(tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->entries)
+      uringSubmit(r, 0);
+   sqe = (struct io_uring_sqe *) r->sqes + (tail & r->sqMask);
+   memset(sqe, 0, sizeof(*sqe));
+   r->sqArray[tail & r->sqMask] = tail & r->sqMask;
+   return(sqe);
+}
+
+/*-------------------------------------------------------------
+Function: uringRead
+Parameters:
+    r    - the ring
+    fd   - file descriptor to read (a pipe or a socket)
+    buf  - where to put the data
+    len  - size of buf
+    data - value returned with the completion
+Description:
+   Prepares a read (submitted by uringSubmit()).  The read waits
+   for data in the kernel, whether fd is blocking or not; its
+   result is what read() would return (-errno on error).
+-------------------------------------------------------------*/
+void uringRead(struct uring *r, int fd, void *buf, unsigned len, unsigned long long data)
+{
+   struct io_uring_sqe *sqe = uringEntry(r);
+
+   sqe->opcode = IORING_OP_READ;
+   sqe->fd = fd;
+   sqe->addr = (unsigned long) buf;
+   sqe->len = len;
+   sqe->off = -1;  // the current position (pipes and sockets have none)
+   sqe->user_data = data;
+   __atomic_store_n(r->sqTail, *r->sqTail + 1, __ATOMIC_RELEASE);
+}
+
+/*-------------------------------------------------------------
+Function: uringWritev
+Parameters:
+    r    - the ring
+    fd   - file descriptor to write
+    iov  - the data (it must not change until it is submitted)
+    n    - number of entries in iov
+    data - value returned with the completion
+Description:
+   Prepares a writev() (submitted by uringSubmit()); its result is
+   the number of bytes written, which may be less than asked for,
+   or -errno.
+-------------------------------------------------------------*/
+void uringWritev(struct uring *r, int fd, struct iovec *iov, int n, unsigned long long data)
+{
+   struct io_uring_sqe *sqe = uringEntry(r);
+
+   sqe->opcode = IORING_OP_WRITEV;
+   sqe->fd = fd;
+   sqe->addr = (unsigned long) iov;
+   sqe->len = n;
+   sqe->off = -1;
+   sqe->user_data = data;
+   __atomic_store_n(r->sqTail, *r->sqTail + 1, __ATOMIC_RELEASE);
+}
+
+/*-------------------------------------------------------------
+Function: uringSubmit
+Parameters:
+    r    - the ring
+    wait - longest time (usec) to wait for a completion (0: do not
+           wait, -1: no limit)
+Description:
+   Submits the requests prepared and, unless a completion is
+   already waiting, waits for one, in a single io_uring_enter().
+   Returns 0, or -1 on error (ETIME when nothing completed in time,
+   EINTR when interrupted).
+-------------------------------------------------------------*/
+int uringSubmit(struct uring *r, long long wait)
+{
+   struct io_uring_getevents_arg arg;
+   struct __kernel_timespec ts;
+   unsigned toSubmit = *r->sqTail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+   unsigned flags = 0;
+   unsigned minComplete = 0;
+
+   if(wait != 0 && *r->cqHead == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE))
+   {
+      memset(&arg, 0, sizeof(arg));
+      if(wait > 0)
+      {
+         ts.tv_sec = wait / 1000000;
+         ts.tv_nsec = wait % 1000000 * 1000;
+         arg.ts = (unsigned long) &ts;
+      }
+      flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      minComplete = 1;
+   }
+   if(toSubmit == 0 && minComplete == 0) return(0);
+   if(syscall(__NR_io_uring_enter, r->fd, toSubmit, minComplete, flags, flags ? &arg : NULL, sizeof(arg)) == -1)
+      return(-1);
+   return(0);
+}
+
+/*-------------------------------------------------------------
+Function: uringCompletion
+Parameters:
+    r    - the ring
+    data - to return the value of the request that completed
+    res  - to return its result
+Description:
+   Takes the oldest completion.  Returns FALSE if there is none.
+-------------------------------------------------------------*/
+int uringCompletion(struct uring *r, unsigned long long *data, int *res)
+{
+   unsigned head = *r->cqHead;
+   struct io_uring_cqe *cqe;
+
+   if(head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE))
+      return(FALSE);
+   cqe = (struct io_uring_cqe *) r->cqes + (head & r->cqMask);
+   *data = cqe->user_data;
+   *res = cqe->res;
+   __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+   return(TRUE);
+}
+
+#else  // without io_uring: the hub uses its epoll loop
+#pragma GCC diagnostic ignored "-Wunused-parameter"  // the stubs ignore their parameters
+
+int uringOpen(struct uring *r, unsigned entries)
+{
+   r->fd = -1;
+   errno = ENOSYS;
+   return(-1);
+}
+
+void uringClose(struct uring *r) {}
+void uringRead(struct uring *r, int fd, void *buf, unsigned len, unsigned long long data) {}
+void uringWritev(struct uring *r, int fd, struct iovec *iov, int n, unsigned long long data) {}
+
+int uringSubmit(struct uring *r, long long wait)
+{
+   errno = ENOSYS;
+   return(-1);
+}
+
+int uringCompletion(struct uring *r, unsigned long long *data, int *res)
+{
+   return(FALSE);
+}
+
+#endif
@@ -0,0 +1,47 @@
+/*------------------------------------------------------------
+File: uring.h
+
+Description: Minimal io_uring ring for the hub (hub -m uring),
+used through the system calls, without liburing.  Requests are
+prepared in the submission ring (uringRead(), uringWritev()) without
+entering the kernel; uringSubmit() then submits all of them and
+waits for a completion with a single system call, and
+uringCompletion() takes the completions one by one.  A request
+carries a 64-bit value returned with its completion.
+
+The ring needs Linux 5.11 or later (IORING_FEAT_EXT_ARG, for the
+timeout of the wait).  Built with -DNO_URING, or without the kernel
+header, uringOpen() always fails with ENOSYS, so that the hub falls
+back to its epoll loop.
+-------------------------------------------------------------*/
+#ifndef URING_H
+#define URING_H
+
+#include <sys/uio.h>
+
+struct uring
+{
+   int fd;                     // the io_uring instance (-1: none)
+   unsigned entries;           // entries of the submission ring
+   unsigned *sqHead;           // submission ring (shared with the kernel)
+   unsigned *sqTail;
+   unsigned sqMask;
+   unsigned *sqArray;
+   void *sqes;                 // the submission entries
+   unsigned *cqHead;           // completion ring (shared with the kernel)
+   unsigned *cqTail;
+   unsigned cqMask;
+   void *cqes;                 // the completion entries
+   void *ringMap;              // mapping of both rings
+   long ringLen;
+   long sqesLen;               // size of the mapping of sqes
+};
+
+int uringOpen(struct uring *, unsigned);
+void uringClose(struct uring *);
+void uringRead(struct uring *, int, void *, unsigned, unsigned long long);
+void uringWritev(struct uring *, int, struct iovec *, int, unsigned long long);
+int uringSubmit(struct uring *, long long);
+int uringCompletion(struct uring *, unsigned long long *, int *);
+
+#endif